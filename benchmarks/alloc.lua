@@ -0,0 +1,36 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct cffi_bench_rec {
+        int a;
+        double b;
+        char const *c;
+    };
+]]
+
+bench("new scalar", function(n)
+    for i = 1, n do ffi.new("int", i) end
+end)
+
+local int_t = ffi.typeof("int")
+bench("new scalar from ctype", function(n)
+    for i = 1, n do int_t(i) end
+end)
+
+bench("new struct", function(n)
+    for i = 1, n do ffi.new("struct cffi_bench_rec") end
+end)
+
+local rec_t = ffi.typeof("struct cffi_bench_rec")
+bench("new struct initialized", function(n)
+    for i = 1, n do rec_t(i, 2.5) end
+end)
+
+bench("new vla", function(n)
+    for i = 1, n do ffi.new("int[?]", 16) end
+end)
+
+local vla_t = ffi.typeof("double[?]")
+bench("new vla from ctype", function(n)
+    for i = 1, n do vla_t(64) end
+end)
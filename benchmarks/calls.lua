@@ -0,0 +1,94 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    int cffi_bench_f0(void);
+    int cffi_bench_f1(int a);
+    int cffi_bench_f2(int a, int b);
+    int cffi_bench_f3(int a, int b, int c);
+    int cffi_bench_f4(int a, int b, int c, int d);
+    int cffi_bench_f5(int a, int b, int c, int d, int e);
+    int cffi_bench_f6(int a, int b, int c, int d, int e, int f);
+    int cffi_bench_f7(int a, int b, int c, int d, int e, int f, int g);
+    int cffi_bench_f8(
+        int a, int b, int c, int d, int e, int f, int g, int h
+    );
+
+    typedef struct cffi_bench_vec {
+        double x;
+        double y;
+        double z;
+    } cffi_bench_vec;
+    double cffi_bench_dot(cffi_bench_vec a, cffi_bench_vec b);
+    cffi_bench_vec cffi_bench_scale(cffi_bench_vec a, double f);
+
+    int cffi_bench_callback(int (*cb)(int), int v);
+
+    int snprintf(char *buf, size_t n, char const *fmt, ...);
+]]
+
+local C = ffi.C
+
+bench("loop overhead", function(n)
+    for i = 1, n do end
+end)
+
+local f0, f1, f2, f3 = C.cffi_bench_f0, C.cffi_bench_f1, C.cffi_bench_f2,
+    C.cffi_bench_f3
+local f4, f5, f6, f7 = C.cffi_bench_f4, C.cffi_bench_f5, C.cffi_bench_f6,
+    C.cffi_bench_f7
+local f8 = C.cffi_bench_f8
+
+bench("call 0 args", function(n)
+    for i = 1, n do f0() end
+end)
+bench("call 1 arg", function(n)
+    for i = 1, n do f1(i) end
+end)
+bench("call 2 args", function(n)
+    for i = 1, n do f2(i, 2) end
+end)
+bench("call 3 args", function(n)
+    for i = 1, n do f3(i, 2, 3) end
+end)
+bench("call 4 args", function(n)
+    for i = 1, n do f4(i, 2, 3, 4) end
+end)
+bench("call 5 args", function(n)
+    for i = 1, n do f5(i, 2, 3, 4, 5) end
+end)
+bench("call 6 args", function(n)
+    for i = 1, n do f6(i, 2, 3, 4, 5, 6) end
+end)
+bench("call 7 args", function(n)
+    for i = 1, n do f7(i, 2, 3, 4, 5, 6, 7) end
+end)
+bench("call 8 args", function(n)
+    for i = 1, n do f8(i, 2, 3, 4, 5, 6, 7, 8) end
+end)
+
+bench("call through namespace", function(n)
+    for i = 1, n do C.cffi_bench_f1(i) end
+end)
+
+local buf = ffi.new("char[64]")
+local snprintf = C.snprintf
+bench("variadic call", function(n)
+    for i = 1, n do snprintf(buf, 64, "%d %s", i, "x") end
+end)
+
+local va = ffi.new("cffi_bench_vec", 1, 2, 3)
+local vb = ffi.new("cffi_bench_vec", 4, 5, 6)
+local dot, scale = C.cffi_bench_dot, C.cffi_bench_scale
+bench("struct by value args", function(n)
+    for i = 1, n do dot(va, vb) end
+end)
+bench("struct by value return", function(n)
+    for i = 1, n do scale(va, 2) end
+end)
+
+local cb = ffi.cast("int (*)(int)", function(x) return x end)
+local invoke = C.cffi_bench_callback
+bench("callback", function(n)
+    for i = 1, n do invoke(cb, i) end
+end)
+cb:free()
@@ -0,0 +1,32 @@
+local ffi = require("cffi")
+
+-- a header-sized chunk of declarations; names are made unique per run
+local function make_decls(id)
+    local buf = {}
+    for i = 1, 50 do
+        buf[#buf + 1] = ([[
+            typedef struct bench_s%d_%d {
+                int a;
+                unsigned long b;
+                double c[4];
+                struct bench_s%d_%d *next;
+            } bench_t%d_%d;
+            enum bench_e%d_%d { BENCH_A%d_%d, BENCH_B%d_%d = 1 << 4 };
+            int bench_f%d_%d(bench_t%d_%d const *p, char const *fmt, ...);
+        ]]):format(id, i, id, i, id, i, id, i, id, i, id, i, id, i, id, i)
+    end
+    return table.concat(buf)
+end
+
+local decls = {}
+for i = 1, 220 do
+    decls[i] = make_decls(i)
+end
+
+local id = 0
+bench("cdef 150 declarations", function(n)
+    for i = 1, n do
+        id = id + 1
+        ffi.cdef(decls[id])
+    end
+end, 20)
@@ -0,0 +1,60 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct cffi_bench_point {
+        int x;
+        int y;
+        double w;
+    };
+]]
+
+local p = ffi.new("struct cffi_bench_point")
+bench("field get", function(n)
+    local s = 0
+    for i = 1, n do s = s + p.x end
+end)
+bench("field set", function(n)
+    for i = 1, n do p.x = i end
+end)
+bench("double field get/set", function(n)
+    for i = 1, n do p.w = p.w + 1 end
+end)
+
+local arr = ffi.new("int[1024]")
+bench("array get", function(n)
+    local s = 0
+    for i = 1, n do s = s + arr[i % 1024] end
+end)
+bench("array set", function(n)
+    for i = 1, n do arr[i % 1024] = i end
+end)
+
+local parr = ffi.cast("int *", arr)
+bench("pointer index", function(n)
+    local s = 0
+    for i = 1, n do s = s + parr[i % 1024] end
+end)
+
+local a = ffi.new("int64_t", 12345)
+local b = ffi.new("uint64_t", 678)
+bench("int64 arithmetic", function(n)
+    local c
+    for i = 1, n do c = a * 3 + a end
+end)
+bench("uint64 arithmetic", function(n)
+    local c
+    for i = 1, n do c = b * 3 + b end
+end)
+bench("int64 compare", function(n)
+    local c
+    for i = 1, n do c = a < b end
+end)
+
+local str = ffi.new("char[?]", 64)
+ffi.copy(str, "the quick brown fox jumps over the lazy dog")
+bench("cffi.string", function(n)
+    for i = 1, n do ffi.string(str) end
+end)
+bench("cffi.string with length", function(n)
+    for i = 1, n do ffi.string(str, 16) end
+end)
@@ -8,6 +8,7 @@
 #include "platform.hh"
 #include "ast.hh"
 #include "ffi.hh"
+#include "stats.hh"
 
 namespace ast {
 
@@ -606,11 +607,13 @@ c_type::c_type(c_type const &v): p_asize{v.p_asize}, p_type{v.p_type} {
     int tp = type();
     if (tp == C_BUILTIN_FUNC) {
         p_fptr = weak ? v.p_fptr : new c_function{*v.p_fptr};
+        stats::count(stats::TYPE_COPIES, size_t(!weak));
     } else if (
         (tp == C_BUILTIN_PTR) || (tp == C_BUILTIN_REF) ||
         (tp == C_BUILTIN_ARRAY)
     ) {
         p_ptr = weak ? v.p_ptr : new c_type{*v.p_ptr};
+        stats::count(stats::TYPE_COPIES, size_t(!weak));
     } else if ((tp == C_BUILTIN_RECORD) || (tp == C_BUILTIN_ENUM)) {
         p_ptr = v.p_ptr;
     }
@@ -622,6 +625,28 @@ c_type::c_type(c_type &&v):
     p_type{v.p_type}
 {}
 
+size_t c_type::heap_size() const {
+    if (!owns()) {
+        return 0;
+    }
+    switch (type()) {
+        case C_BUILTIN_FUNC: {
+            size_t ret = sizeof(c_function) + p_fptr->result().heap_size();
+            for (auto &par: p_fptr->params()) {
+                ret += sizeof(c_param) + par.type().heap_size();
+            }
+            return ret;
+        }
+        case C_BUILTIN_PTR:
+        case C_BUILTIN_REF:
+        case C_BUILTIN_ARRAY:
+            return sizeof(c_type) + p_ptr->heap_size();
+        default:
+            break;
+    }
+    return 0;
+}
+
 static inline void add_cv(std::string &o, int cv) {
     if (cv & C_CV_CONST) {
         o += " const";
@@ -732,6 +757,13 @@ bool c_type::passable() const {
 #define C_BUILTIN_CASE(bt) case C_BUILTIN_##bt: \
     return ast::builtin_ffi_type<C_BUILTIN_##bt>();
 
+ffi_type *c_type::libffi_call_type() const {
+    if (type() == C_BUILTIN_RECORD) {
+        return p_crec->libffi_call_type();
+    }
+    return libffi_type();
+}
+
 ffi_type *c_type::libffi_type() const {
     switch (c_builtin(type())) {
         C_BUILTIN_CASE(VOID)
@@ -967,6 +999,17 @@ size_t c_record::iter_fields(bool (*cb)(
     return base;
 }
 
+/* the total number of elements of a possibly multidimensional array */
+static size_t array_elems(c_type const &tp, c_type const *&base) {
+    size_t nel = 1;
+    base = &tp;
+    while (base->type() == C_BUILTIN_ARRAY) {
+        nel *= base->array_size();
+        base = &base->ptr_base();
+    }
+    return nel;
+}
+
 void c_record::set_fields(std::vector<field> fields) {
     assert(p_fields.empty());
     assert(!p_elements);
@@ -996,6 +1039,49 @@ void c_record::set_fields(std::vector<field> fields) {
     p_ffi_type.elements = &p_elements[0];
     p_elements[nfields] = nullptr;
 
+    /* libffi has no array type and the one of an array is that of a
+     * pointer, so sized arrays get a struct type of their size; libffi
+     * does not take empty structs, so zero-length arrays stay as they are
+     */
+    p_natypes = 0;
+    p_expand = false;
+    for (size_t i = 0; i < ffields; ++i) {
+        c_type const *et;
+        size_t nel = array_elems(p_fields[i].type, et);
+        if (nel && (p_fields[i].type.type() == C_BUILTIN_ARRAY)) {
+            ++p_natypes;
+            p_expand = true;
+        } else if (
+            (et->type() == C_BUILTIN_RECORD) && et->record().p_expand
+        ) {
+            p_expand = true;
+        }
+    }
+    if (p_natypes) {
+        p_atypes = std::unique_ptr<ffi_type[]>{new ffi_type[p_natypes]};
+        p_aelems = std::unique_ptr<ffi_type *[]>{
+            new ffi_type *[2 * p_natypes]
+        };
+    }
+    size_t atidx = 0;
+    auto field_type = [this, &atidx](c_type const &ft) {
+        c_type const *at;
+        size_t nel = array_elems(ft, at);
+        if (!nel || (ft.type() != C_BUILTIN_ARRAY)) {
+            return ft.libffi_type();
+        }
+        auto *et = at->libffi_type();
+        auto &ret = p_atypes[atidx];
+        ret.size = nel * et->size;
+        ret.alignment = et->alignment;
+        ret.type = FFI_TYPE_STRUCT;
+        ret.elements = &p_aelems[2 * atidx];
+        p_aelems[2 * atidx] = et;
+        p_aelems[2 * atidx + 1] = nullptr;
+        ++atidx;
+        return &ret;
+    };
+
     /* for unions, we have a different logic */
     if (is_union()) {
         size_t usize = 0;
@@ -1007,7 +1093,7 @@ void c_record::set_fields(std::vector<field> fields) {
          * and the alignment of the most aligned
          */
         for (size_t i = 0; i < ffields; ++i) {
-            auto *ft = p_fields[i].type.libffi_type();
+            auto *ft = field_type(p_fields[i].type);
             if (ft->size > usize) {
                 usize = ft->size;
             }
@@ -1016,13 +1102,17 @@ void c_record::set_fields(std::vector<field> fields) {
             }
             p_elements[i] = ft;
         }
+        /* padded like a struct would be */
+        if (ualign) {
+            usize = ((usize + ualign - 1) / ualign) * ualign;
+        }
         p_ffi_type.size = usize;
         p_ffi_type.alignment = ualign;
         return;
     }
 
     for (size_t i = 0; i < ffields; ++i) {
-        p_elements[i] = p_fields[i].type.libffi_type();
+        p_elements[i] = field_type(p_fields[i].type);
     }
     if (flex) {
         /* for now null it, so ffi_prep_cif ignores it */
@@ -1079,6 +1169,70 @@ void c_record::set_fields(std::vector<field> fields) {
     p_ffi_type.size += padn;
 }
 
+ffi_type *c_record::libffi_call_type() const {
+    if (!p_expand) {
+        return libffi_type();
+    }
+    std::call_once(p_call_once, [this]() {
+        /* same as the layout, but with the arrays expanded */
+        bool flex = !is_union() && !p_fields.empty() && (
+            p_fields.back().type.unbounded() || p_fields.back().type.vla()
+        );
+        size_t nfields = p_fields.size();
+        size_t ffields = flex ? (nfields - 1) : nfields;
+        auto is_array = [](c_type const &ft, c_type const *&at) -> size_t {
+            size_t nel = array_elems(ft, at);
+            return (ft.type() == C_BUILTIN_ARRAY) ? nel : 0;
+        };
+        size_t naelems = 0;
+        for (size_t i = 0; i < ffields; ++i) {
+            c_type const *at;
+            if (size_t nel = is_array(p_fields[i].type, at)) {
+                naelems += nel + 1;
+            }
+        }
+        auto ct = std::unique_ptr<call_types>{new call_types{}};
+        ct->elements = std::unique_ptr<ffi_type *[]>{
+            new ffi_type *[nfields + 1]
+        };
+        if (p_natypes) {
+            ct->atypes = std::unique_ptr<ffi_type[]>{
+                new ffi_type[p_natypes]
+            };
+            ct->aelems = std::unique_ptr<ffi_type *[]>{
+                new ffi_type *[naelems]
+            };
+        }
+        size_t atidx = 0, aeidx = 0;
+        for (size_t i = 0; i < ffields; ++i) {
+            c_type const *at;
+            size_t nel = is_array(p_fields[i].type, at);
+            if (!nel) {
+                ct->elements[i] = p_fields[i].type.libffi_call_type();
+                continue;
+            }
+            auto *et = at->libffi_call_type();
+            auto &aty = ct->atypes[atidx++];
+            aty = *p_elements[i];
+            aty.elements = &ct->aelems[aeidx];
+            for (size_t j = 0; j < nel; ++j) {
+                ct->aelems[aeidx++] = et;
+            }
+            ct->aelems[aeidx++] = nullptr;
+            ct->elements[i] = &aty;
+        }
+        if (flex) {
+            /* the padding, if any */
+            ct->elements[ffields] = p_elements[ffields];
+        }
+        ct->elements[nfields] = nullptr;
+        ct->type = p_ffi_type;
+        ct->type.elements = &ct->elements[0];
+        p_call = std::move(ct);
+    });
+    return &p_call->type;
+}
+
 /* decl store implementation, with overlaying for staging */
 
 void decl_store::add(c_object *decl) {
@@ -1135,6 +1289,9 @@ c_object const *decl_store::lookup(char const *name) const {
     if (p_base) {
         return p_base->lookup(name);
     }
+    if (p_shared) {
+        return p_shared->lookup(name);
+    }
     return nullptr;
 }
 
@@ -1146,6 +1303,9 @@ c_object *decl_store::lookup(char const *name) {
     if (p_base) {
         return p_base->lookup(name);
     }
+    if (p_shared) {
+        return p_shared->lookup(name);
+    }
     return nullptr;
 }
 
@@ -1156,12 +1316,168 @@ std::string decl_store::request_name() const {
     decl_store const *pb = this;
     do {
         n += pb->p_dlist.size();
-        pb = pb->p_base;
+        pb = pb->p_base ? pb->p_base : pb->p_shared.get();
     } while (pb);
     snprintf(buf, sizeof(buf), "%zu", n);
     return std::string{static_cast<char const *>(buf)};
 }
 
+static size_t name_size(char const *name) {
+    return strlen(name) + 1;
+}
+
+void decl_store::stats(decl_stats &st) const {
+    for (auto *pb = this; pb; pb = pb->p_shared.get()) {
+        st.ast_bytes += pb->p_dlist.capacity() * sizeof(pb->p_dlist[0]);
+        /* each map entry is a node plus a bucket pointer */
+        st.ast_bytes += pb->p_dmap.size() * (
+            sizeof(*pb->p_dmap.begin()) + 2 * sizeof(void *)
+        ) + pb->p_dmap.bucket_count() * sizeof(void *);
+        for (auto &u: pb->p_dlist) {
+            st.name_bytes += name_size(u->name());
+            switch (u->obj_type()) {
+                case c_object_type::VARIABLE: {
+                    auto &tp = u->as<c_variable>().type();
+                    st.ast_bytes += sizeof(c_variable) + tp.heap_size();
+                    if (tp.type() != C_BUILTIN_FUNC) {
+                        ++st.variables;
+                        break;
+                    }
+                    ++st.functions;
+                    for (auto &par: tp.function().params()) {
+                        st.name_bytes += name_size(par.name());
+                    }
+                    break;
+                }
+                case c_object_type::CONSTANT:
+                    ++st.constants;
+                    st.ast_bytes += sizeof(c_constant) +
+                        u->as<c_constant>().type().heap_size();
+                    break;
+                case c_object_type::TYPEDEF:
+                    ++st.typedefs;
+                    st.ast_bytes += sizeof(c_typedef) +
+                        u->as<c_typedef>().type().heap_size();
+                    break;
+                case c_object_type::RECORD: {
+                    auto &rec = u->as<c_record>();
+                    ++st.records;
+                    st.ast_bytes += sizeof(c_record) +
+                        rec.fields().capacity() * sizeof(c_record::field);
+                    for (auto &fld: rec.fields()) {
+                        st.ast_bytes += fld.type.heap_size();
+                        st.name_bytes += name_size(fld.name.c_str());
+                    }
+                    st.ffi_bytes += rec.elements_size();
+                    break;
+                }
+                case c_object_type::ENUM: {
+                    auto &en = u->as<c_enum>();
+                    ++st.enums;
+                    st.enum_fields += en.fields().size();
+                    st.ast_bytes += sizeof(c_enum) +
+                        en.fields().capacity() * sizeof(c_enum::field);
+                    for (auto &fld: en.fields()) {
+                        st.name_bytes += name_size(fld.name.c_str());
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+    /* enum fields are registered as constants too */
+    st.constants -= st.enum_fields;
+}
+
+std::shared_ptr<decl_store> decl_store::freeze() {
+    /* this should never be used when staging */
+    assert(!p_base);
+    if (p_dlist.empty() && p_shared) {
+        /* nothing new, share the existing one */
+        return p_shared;
+    }
+    auto ds = std::make_shared<decl_store>();
+    for (auto &u: p_dlist) {
+        switch (u->obj_type()) {
+            case c_object_type::RECORD: {
+                auto &rec = u->as<c_record>();
+                if (rec.metatype()) {
+                    /* metatypes stay with us */
+                    p_metatypes.emplace(&rec, rec.release_metatype());
+                }
+                rec.freeze();
+                break;
+            }
+            case c_object_type::ENUM:
+                u->as<c_enum>().freeze();
+                break;
+            default:
+                break;
+        }
+    }
+    ds->p_dlist = std::move(p_dlist);
+    ds->p_dmap = std::move(p_dmap);
+    ds->p_shared = std::move(p_shared);
+    p_dlist.clear();
+    p_dmap.clear();
+    p_shared = std::move(ds);
+    return p_shared;
+}
+
+bool decl_store::has_shared(decl_store const *ds) const {
+    for (auto *pb = p_shared.get(); pb; pb = pb->p_shared.get()) {
+        if (pb == ds) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool decl_store::attach(decl_store &ds, char const *&conflict) {
+    conflict = nullptr;
+    if (has_shared(&ds)) {
+        /* already attached */
+        return true;
+    }
+    /* the new store must be derived from the one we already use */
+    if (p_shared && !ds.has_shared(p_shared.get())) {
+        return false;
+    }
+    for (auto *pb = &ds; pb != p_shared.get(); pb = pb->p_shared.get()) {
+        for (auto const &p: pb->p_dmap) {
+            if (p_dmap.find(p.first) != p_dmap.end()) {
+                conflict = p.first;
+                return false;
+            }
+        }
+    }
+    p_shared = ds.shared_from_this();
+    return true;
+}
+
+c_metatype const *decl_store::metatype(c_record const &rec) const {
+    if (!rec.frozen()) {
+        return rec.metatype();
+    }
+    auto it = p_metatypes.find(&rec);
+    if (it == p_metatypes.end()) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+void decl_store::metatype(
+    c_record const &rec, std::unique_ptr<c_metatype> mt
+) {
+    if (!rec.frozen()) {
+        const_cast<c_record &>(rec).metatype(std::move(mt));
+        return;
+    }
+    p_metatypes[&rec] = std::move(mt);
+}
+
 c_type from_lua_type(lua_State *L, int index) {
     switch (lua_type(L, index)) {
         case LUA_TNIL:
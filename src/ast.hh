@@ -15,6 +15,7 @@
 #include <vector>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 
 namespace ast {
@@ -661,8 +662,14 @@ struct c_type: c_object {
 
     ffi_type *libffi_type() const;
 
+    /* the type to give libffi for passing by value, see c_record */
+    ffi_type *libffi_call_type() const;
+
     size_t alloc_size() const;
 
+    /* the amount of heap memory owned by this type, recursively */
+    size_t heap_size() const;
+
     size_t array_size() const {
         return p_asize;
     }
@@ -880,6 +887,18 @@ private:
     c_type p_type;
 };
 
+/* a metatype assigned to a record
+ *
+ * metatables are immutable once assigned, so each metamethod present
+ * in the table is resolved right away and kept as a registry reference,
+ * indexed by the bit number of its flag
+ */
+struct c_metatype {
+    int mt = LUA_REFNIL;
+    int flags = 0;
+    int fields[32] = {};
+};
+
 /* represents a record type: can be a struct or a union */
 struct c_record: c_object {
     struct field {
@@ -921,6 +940,12 @@ struct c_record: c_object {
         return const_cast<ffi_type *>(&p_ffi_type);
     }
 
+    /* the layout type describes each array member with one element, as
+     * that is enough for the size and alignment; passing by value needs
+     * all elements for classification, so that type is made on first use
+     */
+    ffi_type *libffi_call_type() const;
+
     size_t alloc_size() const {
         return libffi_type()->size;
     }
@@ -959,14 +984,40 @@ struct c_record: c_object {
     /* it is the responsibility of the caller to ensure we're not redefining */
     void set_fields(std::vector<field> fields);
 
-    void metatype(int mt, int mf) {
-        p_metatype = mt;
-        p_metaflags = mf;
+    void metatype(std::unique_ptr<c_metatype> mt) {
+        p_metatype = std::move(mt);
+    }
+
+    c_metatype const *metatype() const {
+        return p_metatype.get();
+    }
+
+    std::unique_ptr<c_metatype> release_metatype() {
+        return std::move(p_metatype);
+    }
+
+    /* records of a frozen declaration store are shared between states,
+     * so they may not be completed and don't carry metatypes themselves
+     */
+    bool frozen() const {
+        return p_frozen;
+    }
+
+    void freeze() {
+        p_frozen = true;
     }
 
-    int metatype(int &flags) const {
-        flags = p_metaflags;
-        return p_metatype;
+    /* size of the libffi element arrays, for declstats */
+    size_t elements_size() const {
+        size_t n = 0;
+        if (p_elements) {
+            n += p_fields.size() + 1;
+        }
+        if (p_felems) {
+            n += p_ffi_flex.size + 1;
+        }
+        n += 2 * p_natypes;
+        return n * sizeof(ffi_type *) + p_natypes * sizeof(ffi_type);
     }
 
     template<typename F>
@@ -991,9 +1042,24 @@ private:
     std::unique_ptr<ffi_type *[]> p_felems{};
     ffi_type p_ffi_type{};
     ffi_type p_ffi_flex{};
-    int p_metatype = LUA_REFNIL;
-    int p_metaflags = 0;
+    /* array members are laid out as structs of their size */
+    std::unique_ptr<ffi_type[]> p_atypes{};
+    std::unique_ptr<ffi_type *[]> p_aelems{};
+    size_t p_natypes = 0;
+    /* records shared between states may be called from several threads */
+    struct call_types {
+        ffi_type type;
+        std::unique_ptr<ffi_type *[]> elements;
+        std::unique_ptr<ffi_type[]> atypes;
+        std::unique_ptr<ffi_type *[]> aelems;
+    };
+    mutable std::unique_ptr<call_types> p_call{};
+    mutable std::once_flag p_call_once{};
+    /* whether the call type differs from the layout type */
+    bool p_expand = false;
+    std::unique_ptr<c_metatype> p_metatype{};
     bool p_uni;
+    bool p_frozen = false;
 };
 
 struct c_enum: c_object {
@@ -1046,6 +1112,14 @@ struct c_enum: c_object {
         return p_opaque;
     }
 
+    bool frozen() const {
+        return p_frozen;
+    }
+
+    void freeze() {
+        p_frozen = true;
+    }
+
     /* it is the responsibility of the caller to ensure we're not redefining */
     void set_fields(std::vector<field> fields) {
         assert(p_fields.empty());
@@ -1059,15 +1133,46 @@ private:
     std::string p_name;
     std::vector<field> p_fields{};
     bool p_opaque = true;
+    bool p_frozen = false;
 };
 
 struct redefine_error: public std::runtime_error {
     using std::runtime_error::runtime_error;
 };
 
-struct decl_store {
+/* a summary of the declarations visible in a store, see cffi.declstats */
+struct decl_stats {
+    size_t records = 0;
+    size_t functions = 0;
+    size_t variables = 0;
+    size_t typedefs = 0;
+    size_t constants = 0;
+    size_t enums = 0;
+    size_t enum_fields = 0;
+    /* declaration nodes, the type nodes they own and the lookup tables */
+    size_t ast_bytes = 0;
+    /* element arrays of record ffi_types */
+    size_t ffi_bytes = 0;
+    /* declaration, field and parameter name strings */
+    size_t name_bytes = 0;
+};
+
+/* timing of a single cdef call */
+struct parse_record {
+    uint64_t ns;
+    size_t ndecls;
+    size_t nchars;
+};
+
+/* declaration stores can be frozen, which moves all their declarations
+ * into an immutable store that can be shared (by reference count) with
+ * other states; each state then overlays its own declarations on top
+ */
+struct decl_store: std::enable_shared_from_this<decl_store> {
     decl_store() {}
-    decl_store(decl_store &ds): p_base(&ds) {}
+    decl_store(decl_store &ds):
+        std::enable_shared_from_this<decl_store>{}, p_base(&ds)
+    {}
     ~decl_store() {
         drop();
     }
@@ -1084,6 +1189,44 @@ struct decl_store {
 
     std::string request_name() const;
 
+    /* the number of own declarations, enum fields included */
+    size_t size() const {
+        return p_dlist.size();
+    }
+
+    /* collects a summary of own and shared declarations */
+    void stats(decl_stats &st) const;
+
+    /* cdef calls are timed per state */
+    void parsed(parse_record const &rec) {
+        p_parses.push_back(rec);
+        p_parse_ns += rec.ns;
+    }
+
+    std::vector<parse_record> const &parses() const {
+        return p_parses;
+    }
+
+    uint64_t parse_time() const {
+        return p_parse_ns;
+    }
+
+    /* moves own declarations into a new frozen store which is then used
+     * as a base and returned; other states can attach it while they hold
+     * a reference to it
+     */
+    std::shared_ptr<decl_store> freeze();
+
+    /* uses a frozen store as a base; fails when a different frozen store
+     * is already in use (conflict is null) or when the frozen store has
+     * a declaration with the same name as one of ours (conflict is it)
+     */
+    bool attach(decl_store &ds, char const *&conflict);
+
+    /* metatypes of frozen records are kept per state */
+    c_metatype const *metatype(c_record const &rec) const;
+    void metatype(c_record const &rec, std::unique_ptr<c_metatype> mt);
+
     static decl_store &get_main(lua_State *L) {
         lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_DECL_STOR);
         auto *ds = lua::touserdata<decl_store>(L, -1);
@@ -1092,11 +1235,19 @@ struct decl_store {
         return *ds;
     }
 private:
+    bool has_shared(decl_store const *ds) const;
+
     decl_store *p_base = nullptr;
+    std::shared_ptr<decl_store> p_shared{};
     std::vector<std::unique_ptr<c_object>> p_dlist{};
     std::unordered_map<
         char const *, c_object *, util::str_hash, util::str_equal
     > p_dmap{};
+    std::unordered_map<
+        c_record const *, std::unique_ptr<c_metatype>
+    > p_metatypes{};
+    std::vector<parse_record> p_parses{};
+    uint64_t p_parse_ns = 0;
 };
 
 c_type from_lua_type(lua_State *L, int index);
@@ -1,12 +1,28 @@
 #include <limits>
 #include <type_traits>
 #include <algorithm>
+#include <chrono>
 
 #include "platform.hh"
 #include "ffi.hh"
+#include "shm.hh"
+#include "stats.hh"
+
+namespace lua {
+char const CFFI_CDATA_MT_KEY = 0;
+char const CFFI_MEM_STATS_KEY = 0;
+} /* namespace lua */
+
+#ifdef HAVE_STATS
+namespace stats {
+thread_local size_t counters[COUNTER_MAX];
+} /* namespace stats */
+#endif
 
 namespace ffi {
 
+char const scalar_mt_keys[ast::C_BUILTIN_DOUBLE + 1] = {};
+
 static inline void fail_convert_cd(
     lua_State *L, ast::c_type const &from, ast::c_type const &to
 ) {
@@ -57,40 +73,90 @@ static ffi_type *lua_to_vararg(lua_State *L, int index) {
     return &ffi_type_void;
 }
 
-static inline void *fdata_retval(fdata &fd) {
-    return &fd.rarg;
-}
+/* reported to the collector in steps of at least this many bytes */
+static constexpr size_t MEM_DEBT_STEP = 64 * 1024;
 
-static inline arg_stor_t *&fdata_get_aux(fdata &fd) {
-    union { arg_stor_t **np; arg_stor_t *op; } u;
-    u.op = fd.args();
-    return *u.np;
+static void mem_alloc(
+    lua_State *L, mem_stats &ms, mem_category cat, size_t sz
+) {
+    if (!sz) {
+        return;
+    }
+    stats::count(stats::BYTES, sz);
+    ms.bytes[cat] += sz;
+    ms.debt += sz;
+    if (ms.debt >= MEM_DEBT_STEP) {
+        int kb = int(ms.debt >> 10);
+        ms.debt = 0;
+        lua_gc(L, LUA_GCSTEP, kb);
+    }
 }
 
-static inline void fdata_free_aux(fdata &fd) {
-    auto &aux = fdata_get_aux(fd);
-    delete[] reinterpret_cast<unsigned char *>(aux);
-    aux = nullptr;
+static void mem_free(mem_stats &ms, mem_category cat, size_t sz) {
+    ms.bytes[cat] -= sz;
+    ms.debt = (ms.debt > sz) ? (ms.debt - sz) : 0;
 }
 
-static inline void fdata_new_aux(fdata &fd, size_t sz) {
-    fdata_get_aux(fd) = reinterpret_cast<arg_stor_t *>(new unsigned char[sz]);
+void mem_alloc(lua_State *L, mem_category cat, size_t sz) {
+    if (sz) {
+        mem_alloc(L, mem_stats::get_main(L), cat, sz);
+    }
 }
 
-static inline ffi_type **fargs_types(void *args, size_t nargs) {
-    auto *bp = static_cast<arg_stor_t *>(args);
-    return reinterpret_cast<ffi_type **>(&bp[nargs]);
+void mem_free(lua_State *L, mem_category cat, size_t sz) {
+    if (sz) {
+        mem_free(mem_stats::get_main(L), cat, sz);
+    }
 }
 
-static inline void **fargs_values(void *args, size_t nargs) {
-    return reinterpret_cast<void **>(&fargs_types(args, nargs)[nargs]);
+void mem_cdata_new(lua_State *L, ast::c_type const &tp, size_t usz) {
+    if (stats::enabled) {
+        switch (tp.type()) {
+            case ast::C_BUILTIN_PTR:
+            case ast::C_BUILTIN_REF:
+            case ast::C_BUILTIN_FUNC:
+                if (tp.callable()) {
+                    stats::count(
+                        tp.closure() ? stats::CDATA_CALLBACK
+                                     : stats::CDATA_FUNC
+                    );
+                } else {
+                    stats::count(stats::CDATA_POINTER);
+                }
+                break;
+            case ast::C_BUILTIN_RECORD:
+                stats::count(stats::CDATA_RECORD);
+                break;
+            case ast::C_BUILTIN_ARRAY:
+                stats::count(stats::CDATA_ARRAY);
+                break;
+            default:
+                stats::count(stats::CDATA_SCALAR);
+                break;
+        }
+        stats::count(stats::BYTES, usz);
+    }
+    auto &ms = mem_stats::get_main(L);
+    ++ms.ncdata;
+    ms.cdata_bytes += usz;
+    mem_alloc(L, ms, MEM_CTYPE, tp.heap_size());
 }
 
-void destroy_cdata(lua_State *L, cdata<noval> &cd) {
+void destroy_cdata(lua_State *L, int idx) {
+    idx = lua_absindex(L, idx);
+    auto &cd = tocdata<noval>(L, idx);
+    auto &ms = mem_stats::get_main(L);
+    if (isctype(cd)) {
+        /* ctypes have no value or finalizer */
+        mem_free(ms, MEM_CTYPE, cd.decl.heap_size());
+        using T = ast::c_type;
+        cd.decl.~T();
+        return;
+    }
     auto &fd = *reinterpret_cast<cdata<fdata> *>(&cd.decl);
     if (cd.gc_ref >= 0) {
         lua_rawgeti(L, LUA_REGISTRYINDEX, cd.gc_ref);
-        lua_pushvalue(L, 1); /* the cdata */
+        lua_pushvalue(L, idx); /* the cdata */
         if (lua_pcall(L, 1, 0, 0)) {
             lua_pop(L, 1);
         }
@@ -100,45 +166,166 @@ void destroy_cdata(lua_State *L, cdata<noval> &cd) {
         /* this is O(n) which sucks a little */
         fd.val.cd->refs.remove(&fd.val.cd);
     }
-    switch (cd.decl.type()) {
-        case ast::C_BUILTIN_PTR:
-            if (cd.decl.ptr_base().type() != ast::C_BUILTIN_FUNC) {
-                break;
-            }
-            goto free_aux;
-        free_aux:
-        case ast::C_BUILTIN_FUNC: {
-            if (!fd.decl.function().variadic()) {
-                break;
-            }
-            fdata_free_aux(fd.val);
-        }
-        default:
-            break;
+    if (
+        (cd.decl.type() == ast::C_BUILTIN_PTR) &&
+        (cd.decl.ptr_base().type() != ast::C_BUILTIN_FUNC) &&
+        (cd.aux > 0)
+    ) {
+        /* views drop the reference to the value they anchor */
+        luaL_unref(L, LUA_REGISTRYINDEX, cd.aux);
+    } else if (cd.aux == AUX_MAPPED) {
+        auto *mp = reinterpret_cast<mapping *>(
+            static_cast<unsigned char *>(lua_touserdata(L, idx)) +
+            lua_rawlen(L, idx) - sizeof(mapping)
+        );
+        shm::unmap(mp->addr, mp->size);
+        mem_free(ms, MEM_MAPPED, mp->size);
     }
+    --ms.ncdata;
+    ms.cdata_bytes -= lua_rawlen(L, idx);
+    mem_free(ms, MEM_CTYPE, cd.decl.heap_size());
     using T = ast::c_type;
     cd.decl.~T();
 }
 
 void destroy_closure(closure_data *cd) {
+    if (cd->L) {
+        mem_free(cd->L, MEM_CLOSURE, cd->msize);
+    }
     cd->~closure_data();
     delete[] reinterpret_cast<unsigned char *>(cd);
 }
 
-static void cb_bind(ffi_cif *, void *ret, void *args[], void *data) {
-    auto &fud = *static_cast<cdata<fdata> *>(data);
+std::atomic<int> profile_running{0};
+
+void profile_data::start() {
+    calls.clear();
+    callbacks.clear();
+    if (!running) {
+        running = true;
+        profile_running.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void profile_data::stop() {
+    if (running) {
+        running = false;
+        profile_running.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+std::atomic<int> trace_running{0};
+
+void trace_data::start() {
+    sites.clear();
+    if (!running) {
+        running = true;
+        trace_running.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void trace_data::stop() {
+    if (running) {
+        running = false;
+        trace_running.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void trace_record(lua_State *L, trace_event ev) {
+    lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_TRACE);
+    auto *td = lua::touserdata<trace_data>(L, -1);
+    lua_pop(L, 1);
+    if (!td || !td->running) {
+        return;
+    }
+    /* the innermost frame running Lua code is the one to blame */
+    lua_Debug ar;
+    std::string site = "?";
+    for (int lev = 0; lua_getstack(L, lev, &ar); ++lev) {
+        lua_getinfo(L, "Sl", &ar);
+        if (ar.currentline > 0) {
+            site = ar.short_src;
+            site += ':';
+            site += std::to_string(ar.currentline);
+            break;
+        }
+    }
+    ++td->sites[site].counts[ev];
+}
+
+/* the calls are instantiated with one of these; the one used when nothing
+ * is being profiled does nothing and compiles away entirely
+ */
+struct no_profile {
+    void start() {}
+    void args_done() {}
+    void call_done() {}
+    void ret_done() {}
+};
+
+struct call_profile {
+    using clock = std::chrono::steady_clock;
+
+    clock::time_point last;
+    uint64_t args_ns = 0, call_ns = 0, ret_ns = 0;
+
+    uint64_t lap() {
+        auto now = clock::now();
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            now - last
+        ).count();
+        last = now;
+        return uint64_t(ns);
+    }
+
+    void start() {
+        last = clock::now();
+    }
+
+    void args_done() {
+        args_ns = lap();
+    }
+
+    void call_done() {
+        call_ns = lap();
+    }
+
+    void ret_done() {
+        ret_ns = lap();
+    }
+
+    void record(
+        std::unordered_map<std::string, profile_entry> &ents,
+        cdata<fdata> const &fud
+    ) {
+        auto &e = ents[fud.val.name ? fud.val.name : fud.decl.serialize()];
+        ++e.calls;
+        e.call_ns += call_ns;
+        e.max_ns = std::max(e.max_ns, call_ns);
+        e.args_ns += args_ns;
+        e.ret_ns += ret_ns;
+    }
+};
+
+template<typename P>
+static void cb_bind_impl(
+    void *ret, void *args[], cdata<fdata> &fud, P &prof
+) {
     auto &fun = fud.decl.function();
     auto &pars = fun.params();
     size_t fargs = pars.size();
 
     closure_data &cd = *fud.val.cd;
+    prof.start();
     lua_rawgeti(cd.L, LUA_REGISTRYINDEX, cd.fref);
     for (size_t i = 0; i < fargs; ++i) {
         to_lua(cd.L, pars[i].type(), args[i], RULE_PASS);
     }
+    prof.args_done();
 
     if (fun.result().type() != ast::C_BUILTIN_VOID) {
         lua_call(cd.L, int(fargs), 1);
+        prof.call_done();
         arg_stor_t stor;
         size_t rsz;
         void *rp = from_lua(
@@ -148,7 +335,24 @@ static void cb_bind(ffi_cif *, void *ret, void *args[], void *data) {
         lua_pop(cd.L, 1);
     } else {
         lua_call(cd.L, int(fargs), 0);
+        prof.call_done();
     }
+    prof.ret_done();
+}
+
+static void cb_bind(ffi_cif *, void *ret, void *args[], void *data) {
+    auto &fud = *static_cast<cdata<fdata> *>(data);
+    if (profile_running.load(std::memory_order_relaxed)) {
+        auto *pd = profile_data::get(fud.val.cd->L);
+        if (pd) {
+            call_profile prof;
+            cb_bind_impl(ret, args, fud, prof);
+            prof.record(pd->callbacks, fud);
+            return;
+        }
+    }
+    no_profile prof;
+    cb_bind_impl(ret, args, fud, prof);
 }
 
 /* this initializes a non-vararg cif with the given number of arguments
@@ -159,18 +363,19 @@ static bool prepare_cif(
     ast::c_function const &func, ffi_cif &cif, ffi_type **targs, size_t nargs
 ) {
     for (size_t i = 0; i < nargs; ++i) {
-        targs[i] = func.params()[i].libffi_type();
+        targs[i] = func.params()[i].type().libffi_call_type();
     }
     using U = unsigned int;
+    stats::count(stats::PREP_CIF);
     return (ffi_prep_cif(
         &cif, FFI_DEFAULT_ABI, U(nargs),
-        func.result().libffi_type(), targs
+        func.result().libffi_call_type(), targs
     ) == FFI_OK);
 }
 
 static void make_cdata_func(
     lua_State *L, void (*funp)(), ast::c_function const &func, bool fptr,
-    closure_data *cd
+    closure_data *cd, char const *name = nullptr
 ) {
     size_t nargs = func.params().size();
 
@@ -182,15 +387,9 @@ static void make_cdata_func(
      *     <cdata header>
      *     struct fdata {
      *         <fdata header>
-     *         arg_stor_t val1; // lua arg1
-     *         arg_stor_t val2; // lua arg2
-     *         arg_stor_t valN; // lua argN
      *         ffi_type *arg1; // type
      *         ffi_type *arg2; // type
      *         ffi_type *argN; // type
-     *         void *valp1;    // &val1
-     *         void *valpN;    // &val2
-     *         void *valpN;    // &valN
      *     } val;
      * }
      *
@@ -200,30 +399,32 @@ static void make_cdata_func(
      *     <cdata header>
      *     struct fdata {
      *         <fdata header>
-     *         void *aux; // vals + types + args like above, but dynamic
      *     } val;
      * }
+     *
+     * argument values are not stored here, see call_cif; vararg funcs
+     * get their whole cif prepared at call time
      */
-    ast::c_type funct{&func, 0, funp == nullptr};
-    auto &fud = newcdata<fdata>(
-        L, fptr ? ast::c_type{std::move(funct), 0} : std::move(funct),
-        func.variadic() ? sizeof(void *) : (
-            sizeof(arg_stor_t) * nargs + sizeof(void *) * nargs * 2
-        )
-    );
-    fud.val.sym = funp;
-
+    /* function pointers and callbacks may come from a temporary ctype,
+     * so they need their own copy of the signature
+     */
+    ast::c_type funct = (fptr || !funp)
+        ? ast::c_type{func, 0, funp == nullptr}
+        : ast::c_type{&func, 0, false};
     if (func.variadic()) {
-        fdata_get_aux(fud.val) = nullptr;
         if (!funp) {
             luaL_error(L, "variadic callbacks are not supported");
         }
         nargs = 0;
     }
+    auto &fud = newcdata<fdata>(
+        L, fptr ? ast::c_type{std::move(funct), 0} : std::move(funct),
+        sizeof(ffi_type *) * nargs
+    );
+    fud.val.sym = funp;
+    fud.val.name = name;
 
-    if (!prepare_cif(
-        func, fud.val.cif, fargs_types(fud.val.args(), nargs), nargs
-    )) {
+    if (!prepare_cif(func, fud.val.cif, fud.val.targs(), nargs)) {
         luaL_error(L, "unexpected failure setting up '%s'", func.name());
     }
 
@@ -239,6 +440,10 @@ static void make_cdata_func(
             sizeof(closure_data) + nargs * sizeof(ffi_type *)
         ]);
         new (cd) closure_data{};
+        cd->L = L;
+        cd->msize = sizeof(closure_data) + nargs * sizeof(ffi_type *) +
+            sizeof(ffi_closure);
+        mem_alloc(L, MEM_CLOSURE, cd->msize);
         /* allocate a closure in it */
         cd->closure = static_cast<ffi_closure *>(ffi_closure_alloc(
             sizeof(ffi_closure), reinterpret_cast<void **>(&fud.val.sym)
@@ -264,84 +469,163 @@ static void make_cdata_func(
                 func.serialize().c_str()
             );
         }
-        cd->L = L;
         /* register this reference within the closure */
         cd->refs.push_front(&fud.val.cd);
         fud.val.cd = cd;
     }
 }
 
-static bool prepare_cif_var(
-    lua_State *L, cdata<fdata> &fud, size_t nargs, size_t fargs
-) {
-    auto &func = fud.decl.function();
-
-    auto &auxptr = fdata_get_aux(fud.val);
-    if (auxptr && (nargs > size_t(fud.aux))) {
-        fdata_free_aux(fud.val);
+/* argument storage is set up separately for every call, so that the same
+ * function can be entered again (e.g. from a callback) while a call to it
+ * is still in progress; small calls keep everything on the C stack, the
+ * rest gets a block from a small per-state pool of userdata, which stays
+ * on the Lua stack for the duration of the call so that a conversion
+ * error simply leaves the block to the collector
+ */
+static constexpr size_t CALL_STACK_ARGS = 8;
+static constexpr size_t CALL_SCRATCH_MIN = 512;
+static constexpr size_t CALL_SCRATCH_POOL = 8;
+
+static void *scratch_get(lua_State *L, size_t sz) {
+    lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_CALL_SCRATCH);
+    int n = int(lua_rawlen(L, -1));
+    if (n) {
+        lua_rawgeti(L, -1, n);
+        lua_pushnil(L);
+        lua_rawseti(L, -3, n);
+        if (lua_rawlen(L, -1) >= sz) {
+            lua_remove(L, -2);
+            return lua_touserdata(L, -1);
+        }
+        /* too small, make a bigger one to take its place */
+        lua_pop(L, 1);
     }
-    if (!auxptr) {
-        fdata_new_aux(
-            fud.val, nargs * sizeof(arg_stor_t) + 2 * nargs * sizeof(void *)
-        );
-        fud.aux = int(nargs);
+    lua_pop(L, 1);
+    return lua_newuserdata(L, std::max(sz, CALL_SCRATCH_MIN));
+}
+
+static void scratch_put(lua_State *L, int idx) {
+    lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_CALL_SCRATCH);
+    int n = int(lua_rawlen(L, -1));
+    if (size_t(n) < CALL_SCRATCH_POOL) {
+        lua_pushvalue(L, idx);
+        lua_rawseti(L, -2, n + 1);
     }
+    lua_pop(L, 1);
+    lua_remove(L, idx);
+}
 
-    ffi_type **targs = fargs_types(auxptr, nargs);
+static bool prepare_cif_var(
+    lua_State *L, ast::c_function const &func, ffi_cif &cif,
+    ffi_type **targs, size_t nargs, size_t fargs
+) {
     for (size_t i = 0; i < fargs; ++i) {
-        targs[i] = func.params()[i].libffi_type();
+        targs[i] = func.params()[i].type().libffi_call_type();
     }
     for (size_t i = fargs; i < nargs; ++i) {
         targs[i] = lua_to_vararg(L, int(i + 2));
     }
 
     using U = unsigned int;
+    stats::count(stats::PREP_CIF_VAR);
     return (ffi_prep_cif_var(
-        &fud.val.cif, FFI_DEFAULT_ABI, U(fargs), U(nargs),
-        func.result().libffi_type(), targs
+        &cif, FFI_DEFAULT_ABI, U(fargs), U(nargs),
+        func.result().libffi_call_type(), targs
     ) == FFI_OK);
 }
 
-int call_cif(cdata<fdata> &fud, lua_State *L, size_t largs) {
+template<typename P>
+static int call_cif_impl(
+    cdata<fdata> &fud, lua_State *L, size_t largs, void *rdst, P &prof
+) {
+    prof.start();
     auto &func = fud.decl.function();
     auto &pdecls = func.params();
 
     size_t nargs = pdecls.size();
     size_t targs = nargs;
+    if (func.variadic()) {
+        targs = std::max(largs, nargs);
+    }
+
+    arg_stor_t sargs[CALL_STACK_ARGS];
+    void *svals[CALL_STACK_ARGS];
+    ffi_type *stypes[CALL_STACK_ARGS];
+    arg_stor_t sret;
+
+    arg_stor_t *pvals = sargs;
+    void **vals = svals;
+    ffi_type **tvals = stypes;
+    void *rval = &sret;
+
+    /* results can be written straight into a destination as long as the
+     * storage libffi expects for them is exactly their size, which is the
+     * case for anything made of whole ffi_args and for anything too big to
+     * be returned in registers
+     */
+    size_t rdsz = func.result().alloc_size();
+    if (rdst && (
+        !(rdsz % sizeof(ffi_arg)) || (rdsz > sizeof(arg_stor_t))
+    )) {
+        rval = rdst;
+    }
 
-    arg_stor_t *pvals = fud.val.args();
-    void *rval = fdata_retval(fud.val);
+    /* results are usually small enough for one argument slot; anything
+     * else is returned through memory of its own size
+     */
+    size_t rsz = 0;
+    if ((rval != rdst) && (rdsz > sizeof(arg_stor_t))) {
+        rsz = (rdsz + sizeof(arg_stor_t) - 1) / sizeof(arg_stor_t);
+    }
 
+    int sidx = 0;
+    if ((targs > CALL_STACK_ARGS) || rsz) {
+        auto *sp = static_cast<arg_stor_t *>(scratch_get(
+            L, (targs + rsz) * sizeof(arg_stor_t) +
+                targs * (sizeof(void *) + sizeof(ffi_type *))
+        ));
+        sidx = lua_gettop(L);
+        if (rsz) {
+            rval = sp;
+        }
+        pvals = sp + rsz;
+        vals = reinterpret_cast<void **>(&pvals[targs]);
+        tvals = reinterpret_cast<ffi_type **>(&vals[targs]);
+    }
+
+    ffi_cif *cif = &fud.val.cif;
+    ffi_cif vcif;
     if (func.variadic()) {
-        targs = std::max(largs, nargs);
-        if (!prepare_cif_var(L, fud, targs, nargs)) {
+        if (!prepare_cif_var(L, func, vcif, tvals, targs, nargs)) {
             luaL_error(L, "unexpected failure setting up '%s'", func.name());
         }
-        pvals = fdata_get_aux(fud.val);
+        cif = &vcif;
     }
 
-    void **vals = fargs_values(pvals, targs);
     /* fixed args */
     for (int i = 0; i < int(nargs); ++i) {
-        size_t rsz;
+        size_t asz;
         vals[i] = from_lua(
-            L, pdecls[i].type(), &pvals[i], i + 2, rsz, RULE_PASS
+            L, pdecls[i].type(), &pvals[i], i + 2, asz, RULE_PASS
         );
     }
     /* variable args */
     for (int i = int(nargs); i < int(targs); ++i) {
-        size_t rsz;
+        size_t asz;
         auto tp = ast::from_lua_type(L, i + 2);
         if (tp.type() == ast::C_BUILTIN_RECORD) {
             /* special case for vararg passing of records: by ptr */
-            auto &cd = tocdata<void *>(L, i + 2);
-            memcpy(&pvals[i], &cd.val, sizeof(void *));
+            auto &cd = tocdata<noval>(L, i + 2);
+            pvals[i].as<void *>() = cd.get_addr();
+            vals[i] = &pvals[i];
             continue;
         }
-        vals[i] = from_lua(L, std::move(tp), &pvals[i], i + 2, rsz, RULE_PASS);
+        vals[i] = from_lua(L, std::move(tp), &pvals[i], i + 2, asz, RULE_PASS);
     }
 
-    ffi_call(&fud.val.cif, fud.val.sym, rval, vals);
+    prof.args_done();
+    ffi_call(cif, fud.val.sym, rval, vals);
+    prof.call_done();
 #ifdef FFI_BIG_ENDIAN
     /* for small return types, ffi_arg must be used to hold the result,
      * and it is assumed that they will be accessed like integers via
@@ -353,13 +637,38 @@ int call_cif(cdata<fdata> &fud, lua_State *L, size_t largs) {
      *
      * there shouldn't be any other places that make this assumption
      */
-    auto rsz = func.result().alloc_size();
-    if (rsz < sizeof(ffi_arg)) {
+    if (rdsz < sizeof(ffi_arg)) {
         auto *p = static_cast<unsigned char *>(rval);
-        rval = p + sizeof(ffi_arg) - rsz;
+        rval = p + sizeof(ffi_arg) - rdsz;
     }
 #endif
-    return to_lua(L, func.result(), rval, RULE_RET);
+    int nret = 0;
+    if (rdst) {
+        if (rval != rdst) {
+            memcpy(rdst, rval, rdsz);
+        }
+    } else {
+        nret = to_lua(L, func.result(), rval, RULE_RET);
+    }
+    if (sidx) {
+        scratch_put(L, sidx);
+    }
+    prof.ret_done();
+    return nret;
+}
+
+int call_cif(cdata<fdata> &fud, lua_State *L, size_t largs, void *rdst) {
+    if (profile_running.load(std::memory_order_relaxed)) {
+        auto *pd = profile_data::get(L);
+        if (pd) {
+            call_profile prof;
+            int nret = call_cif_impl(fud, L, largs, rdst, prof);
+            prof.record(pd->calls, fud);
+            return nret;
+        }
+    }
+    no_profile prof;
+    return call_cif_impl(fud, L, largs, rdst, prof);
 }
 
 template<typename T>
@@ -385,6 +694,8 @@ static inline int push_int(
         return 1;
     }
     /* doesn't fit into the range, so make scalar cdata */
+    stats::count(stats::SLOW_TO_LUA);
+    trace(L, TRACE_BOX);
     auto &cd = newcdata(L, tp, sizeof(T));
     memcpy(&cd.val, value, sizeof(T));
     return 1;
@@ -403,6 +714,8 @@ static inline int push_flt(
         lua_pushnumber(L, lua_Number(*U(value)));
         return 1;
     }
+    stats::count(stats::SLOW_TO_LUA);
+    trace(L, TRACE_BOX);
     auto &cd = newcdata(L, tp, sizeof(T));
     memcpy(&cd.val, value, sizeof(T));
     return 1;
@@ -709,6 +1022,12 @@ static void from_lua_cdata_ptr(
                 /* then init from address */
                 return;
             }
+            if (
+                trace_running.load(std::memory_order_relaxed) &&
+                !cd.is_same(tp, true)
+            ) {
+                trace_record(L, TRACE_PTR_CONVERT);
+            }
             if (!ptr_convertible(cd, tp)) {
                 fail_convert_cd(L, cd, tp);
             }
@@ -726,6 +1045,8 @@ static void *from_lua_cnumber(
     lua_State *L, ast::c_type const &cd, ast::c_type const &tp,
     void *sval, void *stor, size_t &dsz, int rule
 ) {
+    stats::count(stats::SLOW_FROM_LUA);
+    trace(L, TRACE_UNBOX);
 #define CONV_CASE(name, U) \
     case ast::C_BUILTIN_##name: { \
         using UT = U; \
@@ -845,6 +1166,11 @@ static void *from_lua_cdata(
                 (tp.type() != ast::C_BUILTIN_PTR) &&
                 (tp.type() != ast::C_BUILTIN_REF)
             ) {
+                /* and copy records of the same type */
+                if (cd.is_same(tp, true)) {
+                    dsz = cd.alloc_size();
+                    return sval;
+                }
                 break;
             }
             if (rule != RULE_CAST) {
@@ -893,6 +1219,27 @@ static void *from_lua_cdata(
     return nullptr;
 }
 
+/* strings are passed without copying to any pointer to const bytes */
+static inline bool str_convertible(ast::c_type const &tp) {
+    if (tp.type() != ast::C_BUILTIN_PTR) {
+        return false;
+    }
+    auto &pb = tp.ptr_base();
+    if (!(pb.cv() & ast::C_CV_CONST)) {
+        return false;
+    }
+    switch (pb.type()) {
+        case ast::C_BUILTIN_VOID:
+        case ast::C_BUILTIN_CHAR:
+        case ast::C_BUILTIN_SCHAR:
+        case ast::C_BUILTIN_UCHAR:
+            return true;
+        default:
+            break;
+    }
+    return false;
+}
+
 void *from_lua(
     lua_State *L, ast::c_type const &tp, void *stor, int index,
     size_t &dsz, int rule
@@ -941,11 +1288,7 @@ void *from_lua(
             return from_lua_num(L, tp, stor, index, dsz, rule);
             break;
         case LUA_TSTRING:
-            if ((rule == RULE_CAST) || (
-                (tp.type() == ast::C_BUILTIN_PTR) &&
-                (tp.ptr_base().type() == ast::C_BUILTIN_CHAR) &&
-                (tp.ptr_base().cv() & ast::C_CV_CONST)
-            )) {
+            if ((rule == RULE_CAST) || str_convertible(tp)) {
                 dsz = sizeof(char const *);
                 return &(
                     *static_cast<char const **>(stor) = lua_tostring(L, index)
@@ -1019,6 +1362,7 @@ void *from_lua(
                 fail_convert_tp(L, "function", tp);
             }
             lua_pushvalue(L, index);
+            stats::count(stats::REF_CALLBACK);
             *static_cast<int *>(stor) = luaL_ref(L, LUA_REGISTRYINDEX);
             /* we don't have a value to store */
             return nullptr;
@@ -1134,6 +1478,95 @@ static void from_lua_table_record(
     }
 }
 
+/* an array initialized from a cdata array with the same element type is
+ * copied in bulk; pointers have no known size, so they are not accepted
+ */
+static bool from_lua_table_copy(
+    lua_State *L, ast::c_type const &decl, void *stor, size_t rsz, int idx
+) {
+    auto *cd = testcdata<void *>(L, idx);
+    if (!cd) {
+        return false;
+    }
+    auto &sdecl = cd->decl;
+    if ((sdecl.type() != ast::C_BUILTIN_ARRAY) || sdecl.unbounded()) {
+        return false;
+    }
+    if (!sdecl.ptr_base().is_same(decl.ptr_base(), true)) {
+        return false;
+    }
+    size_t csz = cdata_value_size(L, idx);
+    if (csz > rsz) {
+        csz = rsz;
+    }
+    if (!cd->val) {
+        return false;
+    }
+    memcpy(stor, cd->val, csz);
+    if (csz < rsz) {
+        memset(static_cast<unsigned char *>(stor) + csz, 0, rsz - csz);
+    }
+    return true;
+}
+
+/* arrays of arithmetic scalars are the most common table initializers, so
+ * they get a loop specialized for the element type; numbers are written out
+ * directly and anything else goes through the generic conversion
+ */
+template<typename T>
+static void from_lua_table_num(
+    lua_State *L, ast::c_type const &pb, unsigned char *val,
+    int tidx, int sidx, int ninit
+) {
+    for (; ninit; --ninit) {
+        push_init(L, tidx, sidx++);
+        if (lua_type(L, -1) == LUA_TNUMBER) {
+            *reinterpret_cast<T *>(val) = std::is_floating_point<T>::value
+                ? T(lua_tonumber(L, -1)) : T(lua_tointeger(L, -1));
+        } else {
+            size_t esz;
+            arg_stor_t sv{};
+            void *ep = from_lua(L, pb, &sv, -1, esz, RULE_CONV);
+            memcpy(val, ep, esz);
+        }
+        val += sizeof(T);
+        lua_pop(L, 1);
+    }
+}
+
+static bool from_lua_table_arith(
+    lua_State *L, ast::c_type const &pb, unsigned char *val,
+    int tidx, int sidx, int ninit
+) {
+    switch (pb.type()) {
+#define NUM_CASE(bt) \
+        case ast::bt: \
+            from_lua_table_num<ast::builtin_t<ast::bt>>( \
+                L, pb, val, tidx, sidx, ninit \
+            ); \
+            return true;
+        NUM_CASE(C_BUILTIN_BOOL)
+        NUM_CASE(C_BUILTIN_CHAR)
+        NUM_CASE(C_BUILTIN_SCHAR)
+        NUM_CASE(C_BUILTIN_UCHAR)
+        NUM_CASE(C_BUILTIN_SHORT)
+        NUM_CASE(C_BUILTIN_USHORT)
+        NUM_CASE(C_BUILTIN_INT)
+        NUM_CASE(C_BUILTIN_UINT)
+        NUM_CASE(C_BUILTIN_LONG)
+        NUM_CASE(C_BUILTIN_ULONG)
+        NUM_CASE(C_BUILTIN_LLONG)
+        NUM_CASE(C_BUILTIN_ULLONG)
+        NUM_CASE(C_BUILTIN_FLOAT)
+        NUM_CASE(C_BUILTIN_DOUBLE)
+        NUM_CASE(C_BUILTIN_LDOUBLE)
+#undef NUM_CASE
+        default:
+            break;
+    }
+    return false;
+}
+
 /* this can't be done in from_lua, because when from_lua is called, the
  * memory is not allocated yet... so do it here, as a special case
  */
@@ -1159,6 +1592,15 @@ static void from_lua_table(
     bool base_array = (pb.type() == ast::C_BUILTIN_ARRAY);
     bool base_struct = (pb.type() == ast::C_BUILTIN_RECORD);
 
+    if (ninit == 1) {
+        push_init(L, tidx, sidx);
+        bool copied = from_lua_table_copy(L, decl, stor, rsz, -1);
+        lua_pop(L, 1);
+        if (copied) {
+            return;
+        }
+    }
+
     if (!decl.vla() && !decl.unbounded()) {
         if (ninit > int(nelems)) {
             luaL_error(L, "too many initializers");
@@ -1179,21 +1621,29 @@ static void from_lua_table(
         }
     }
 
-    for (int rinit = ninit; rinit; --rinit) {
-        if ((base_array || base_struct) && lua_istable(L, -1)) {
-            int ntidx = lua_gettop(L);
-            int nninit;
-            int nsidx = get_init_sidx(L, ntidx, nninit);
-            from_lua_table(L, pb, val, bsize, ntidx, nsidx, nninit);
-        } else {
-            size_t esz;
-            arg_stor_t sv{};
+    if (from_lua_table_arith(L, pb, val, tidx, sidx, ninit)) {
+        val += bsize * size_t(ninit);
+    } else {
+        for (int rinit = ninit; rinit; --rinit) {
             push_init(L, tidx, sidx++);
-            void *ep = from_lua(L, pb, &sv, -1, esz, RULE_CONV);
-            memcpy(val, ep, esz);
+            if ((base_array || base_struct) && lua_istable(L, -1)) {
+                int ntidx = lua_gettop(L);
+                int nninit;
+                int nsidx = get_init_sidx(L, ntidx, nninit);
+                from_lua_table(L, pb, val, bsize, ntidx, nsidx, nninit);
+            } else if (
+                base_array && from_lua_table_copy(L, pb, val, bsize, -1)
+            ) {
+                /* nested array copied from a cdata array */
+            } else {
+                size_t esz;
+                arg_stor_t sv{};
+                void *ep = from_lua(L, pb, &sv, -1, esz, RULE_CONV);
+                memcpy(val, ep, esz);
+            }
+            val += bsize;
+            lua_pop(L, 1);
         }
-        val += bsize;
-        lua_pop(L, 1);
     }
     if (ninit < int(nelems)) {
         /* fill possible remaining space with zeroes */
@@ -1217,7 +1667,7 @@ void get_global(lua_State *L, lib::c_lib const *dl, const char *sname) {
             if (var.type() == ast::C_BUILTIN_FUNC) {
                 make_cdata_func(
                     L, reinterpret_cast<void (*)()>(symp),
-                    var.function(), false, nullptr
+                    var.function(), false, nullptr, decl->name()
                 );
             } else {
                 to_lua(
@@ -1243,7 +1693,7 @@ void set_global(lua_State *L, lib::c_lib const *dl, char const *sname, int idx)
     auto &ds = ast::decl_store::get_main(L);
     auto const *decl = ds.lookup(sname);
     if (!decl) {
-        luaL_error(L, "missing declaration for symbol '%s'", decl->name());
+        luaL_error(L, "missing declaration for symbol '%s'", sname);
         return;
     }
     if (decl->obj_type() != ast::c_object_type::VARIABLE) {
@@ -1394,6 +1844,8 @@ newdata:
              * or we have a single table initializer, in which case its
              * contents are used for initialization instead
              */
+            stats::count(stats::SLOW_FROM_LUA);
+            trace(L, TRACE_TABLE_INIT);
             if ((ninits > 1) || !lua_istable(L, iidx)) {
                 from_lua_table(L, decl, dptr, msz, 0, iidx, ninits);
             } else {
@@ -1404,12 +1856,11 @@ newdata:
         }
         /* set a gc finalizer if provided in metatype */
         if (decl.type() == ast::C_BUILTIN_RECORD) {
-            int mf;
-            int mt = decl.record().metatype(mf);
-            if (mf & METATYPE_FLAG_GC) {
-                if (metatype_getfield(L, mt, "__gc")) {
-                    cd.gc_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-                }
+            if (metatype_getfield(
+                L, record_metatype(L, decl.record()), METATYPE_FLAG_GC
+            )) {
+                stats::count(stats::REF_FINALIZER);
+                cd.gc_ref = luaL_ref(L, LUA_REGISTRYINDEX);
             }
         }
     }
@@ -2,9 +2,13 @@
 #define FFI_HH
 
 #include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <type_traits>
 #include <list>
+#include <atomic>
+#include <string>
+#include <unordered_map>
 
 #include "libffi.hh"
 
@@ -59,44 +63,13 @@ enum metatype_flag {
 #endif /* LUA_VERSION_NUM > 501 */
 };
 
-static inline constexpr auto metafield_name(metatype_flag flag) {
-    switch (flag) {
-        case METATYPE_FLAG_ADD:      return "__add";
-        case METATYPE_FLAG_SUB:      return "__sub";
-        case METATYPE_FLAG_MUL:      return "__mul";
-        case METATYPE_FLAG_DIV:      return "__div";
-        case METATYPE_FLAG_MOD:      return "__mod";
-        case METATYPE_FLAG_POW:      return "__pow";
-        case METATYPE_FLAG_UNM:      return "__unm";
-        case METATYPE_FLAG_CONCAT:   return "__concat";
-        case METATYPE_FLAG_LEN:      return "__len";
-        case METATYPE_FLAG_EQ:       return "__eq";
-        case METATYPE_FLAG_LT:       return "__lt";
-        case METATYPE_FLAG_LE:       return "__le";
-        case METATYPE_FLAG_INDEX:    return "__index";
-        case METATYPE_FLAG_NEWINDEX: return "__newindex";
-        case METATYPE_FLAG_CALL:     return "__call";
-        case METATYPE_FLAG_GC:       return "__gc";
-        case METATYPE_FLAG_TOSTRING: return "__tostring";
-        case METATYPE_FLAG_NEW:      return "__new";
-#if LUA_VERSION_NUM > 501
-        case METATYPE_FLAG_PAIRS:    return "__pairs";
-#if LUA_VERSION_NUM == 502
-        case METATYPE_FLAG_IPAIRS:   return "__ipairs";
-#endif
-#if LUA_VERSION_NUM > 502
-        case METATYPE_FLAG_IDIV:     return "__idiv";
-        case METATYPE_FLAG_BAND:     return "__band";
-        case METATYPE_FLAG_BOR:      return "__bor";
-        case METATYPE_FLAG_BXOR:     return "__bxor";
-        case METATYPE_FLAG_BNOT:     return "__bnot";
-        case METATYPE_FLAG_SHL:      return "__shl";
-        case METATYPE_FLAG_SHR:      return "__shr";
-#endif /* LUA_VERSION_NUM > 502 */
-#endif /* LUA_VERSION_NUM > 501 */
-        default: break;
+/* the bit number of a flag, which indexes c_metatype fields */
+static inline constexpr int metafield_idx(metatype_flag flag) {
+    int ret = 0;
+    for (auto f = unsigned(flag); f > 1; f >>= 1) {
+        ++ret;
     }
-    return "";
+    return ret;
 }
 
 struct arg_stor_t {
@@ -116,14 +89,130 @@ struct arg_stor_t {
 
 struct noval {};
 
+/* accounting of memory allocated outside of the Lua heap
+ *
+ * the collector only sees the size of our userdata, so everything that is
+ * allocated separately (type chains, callbacks, mappings) is tracked here
+ * per state and reported to the collector as extra debt
+ */
+enum mem_category {
+    MEM_CTYPE = 0, /* type chains owned by cdata and ctypes */
+    MEM_CLOSURE,   /* callbacks */
+    MEM_MAPPED,    /* shared memory mappings */
+    MEM_MAX
+};
+
+struct mem_stats {
+    size_t ncdata;
+    size_t cdata_bytes;
+    size_t bytes[MEM_MAX];
+    /* external bytes not yet reported to the collector */
+    size_t debt;
+
+    static mem_stats &get_main(lua_State *L) {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, &lua::CFFI_MEM_STATS_KEY);
+        auto *ms = lua::touserdata<mem_stats>(L, -1);
+        assert(ms);
+        lua_pop(L, 1);
+        return *ms;
+    }
+};
+
+/* call profiling, see cffi.profile
+ *
+ * calls only look at the process-wide number of running profiles and go
+ * through the profiling path only when it is nonzero, so there is no cost
+ * beyond a branch when nothing is being profiled
+ */
+struct profile_entry {
+    size_t calls;
+    uint64_t call_ns; /* inside the C function or the Lua callback */
+    uint64_t max_ns;
+    uint64_t args_ns; /* converting the arguments */
+    uint64_t ret_ns; /* converting the result */
+};
+
+struct profile_data {
+    /* functions are keyed by their declaration name or their type */
+    std::unordered_map<std::string, profile_entry> calls{};
+    std::unordered_map<std::string, profile_entry> callbacks{};
+    bool running = false;
+
+    /* the data of the state if it is being profiled, otherwise null */
+    static profile_data *get(lua_State *L) {
+        lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_PROFILE);
+        auto *pd = lua::touserdata<profile_data>(L, -1);
+        lua_pop(L, 1);
+        return (pd && pd->running) ? pd : nullptr;
+    }
+
+    void start();
+    void stop();
+};
+
+extern std::atomic<int> profile_running;
+
+/* conversion tracing, see cffi.trace; the slow paths report themselves
+ * here, which costs a branch unless some state is tracing
+ */
+enum trace_event {
+    TRACE_PTR_CONVERT = 0, /* pointer types checked for compatibility */
+    TRACE_STR_COPY,        /* C string copied into a Lua string */
+    TRACE_BOX,             /* number boxed into cdata */
+    TRACE_UNBOX,           /* numeric cdata converted to another type */
+    TRACE_TABLE_INIT,      /* aggregate initialized from Lua values */
+    TRACE_METATYPE_INDEX,  /* field access handled by the metatype */
+    TRACE_MAX
+};
+
+struct trace_site {
+    size_t counts[TRACE_MAX];
+};
+
+struct trace_data {
+    /* keyed by source location of the calling Lua code */
+    std::unordered_map<std::string, trace_site> sites{};
+    bool running = false;
+
+    void start();
+    void stop();
+};
+
+extern std::atomic<int> trace_running;
+
+void trace_record(lua_State *L, trace_event ev);
+
+static inline void trace(lua_State *L, trace_event ev) {
+    if (trace_running.load(std::memory_order_relaxed)) {
+        trace_record(L, ev);
+    }
+}
+
+void mem_alloc(lua_State *L, mem_category cat, size_t sz);
+void mem_free(lua_State *L, mem_category cat, size_t sz);
+
+void mem_cdata_new(lua_State *L, ast::c_type const &tp, size_t usz);
+
+/* shared memory mapped for a cdata (see cffi.shm); it is stored at the end
+ * of the userdata and unmapped when the cdata is destroyed, regardless of
+ * its finalizer
+ */
+struct mapping {
+    void *addr;
+    size_t size;
+};
+
+static constexpr int AUX_MAPPED = -1 - int(MEM_MAPPED);
+
 template<typename T>
 struct cdata {
     ast::c_type decl;
     int gc_ref;
     /* auxiliary data that can be used by different cdata
      *
-     * vararg functions store the number of arguments they have storage
-     * prepared for here to avoid reallocating every time
+     * data pointers that view a lua value (e.g. cffi.view) store a registry
+     * reference to it here in order to keep it alive; cdata owning a shared
+     * memory mapping are tagged with AUX_MAPPED
      */
     int aux;
     alignas(arg_stor_t) T val;
@@ -189,6 +278,7 @@ struct closure_data {
     int fref = LUA_REFNIL;
     lua_State *L = nullptr;
     ffi_closure *closure = nullptr;
+    size_t msize = 0; /* for memory accounting */
 
     /* arguments data follow this struct; it's pointer aligned so it's fine */
     ffi_type **targs() {
@@ -211,20 +301,46 @@ struct closure_data {
     }
 };
 
-/* data used for function types */
+/* data used for function types; the cif is never modified after setup,
+ * so calls do not write into the function cdata and may be reentered
+ */
 struct fdata {
     void (*sym)();
     closure_data *cd; /* only for callbacks, otherwise nullptr */
+    char const *name; /* the declaration, for named functions */
     ffi_cif cif;
-    arg_stor_t rarg;
 
-    arg_stor_t *args() {
-        union { arg_stor_t *av; fdata *fd; } u;
+    /* argument types follow this struct for non-variadic functions */
+    ffi_type **targs() {
+        union { ffi_type **tp; fdata *fd; } u;
         u.fd = this + 1;
-        return u.av;
+        return u.tp;
     }
 };
 
+/* pointers to and arrays of most scalar types get a metatable with
+ * typed __index and __newindex, stored in the registry under the
+ * address of the element for their base type
+ */
+extern char const scalar_mt_keys[ast::C_BUILTIN_DOUBLE + 1];
+
+static inline void mark_cdata(lua_State *L, ast::c_type const &decl) {
+    auto tp = decl.type();
+    if ((tp == ast::C_BUILTIN_PTR) || (tp == ast::C_BUILTIN_ARRAY)) {
+        auto &base = decl.ptr_base();
+        auto btp = base.type();
+        if (
+            (btp >= ast::C_BUILTIN_CHAR) && (btp <= ast::C_BUILTIN_DOUBLE) &&
+            !(base.cv() & ast::C_CV_VOLATILE)
+        ) {
+            lua_rawgetp(L, LUA_REGISTRYINDEX, &scalar_mt_keys[btp]);
+            lua_setmetatable(L, -2);
+            return;
+        }
+    }
+    lua::mark_cdata(L);
+}
+
 template<typename T>
 static inline cdata<T> &newcdata(
     lua_State *L, ast::c_type &&tp, size_t extra = 0
@@ -233,7 +349,8 @@ static inline cdata<T> &newcdata(
     new (&cd->decl) ast::c_type{std::move(tp)};
     cd->gc_ref = LUA_REFNIL;
     cd->aux = 0;
-    lua::mark_cdata(L);
+    mark_cdata(L, cd->decl);
+    mem_cdata_new(L, cd->decl, sizeof(cdata<T>) + extra);
     return *cd;
 }
 
@@ -253,7 +370,8 @@ static inline cdata<ffi::noval> &newcdata(
     new (&cd->decl) ast::c_type{std::move(tp)};
     cd->gc_ref = LUA_REFNIL;
     cd->aux = 0;
-    lua::mark_cdata(L);
+    mark_cdata(L, cd->decl);
+    mem_cdata_new(L, cd->decl, vals + cdata_value_base());
     return *cd;
 }
 
@@ -263,21 +381,22 @@ static inline ctype &newctype(lua_State *L, A &&...args) {
     cd->ct_tag = lua::CFFI_CTYPE_TAG;
     new (&cd->decl) ast::c_type{std::forward<A>(args)...};
     lua::mark_cdata(L);
+    mem_alloc(L, MEM_CTYPE, cd->decl.heap_size());
     return *cd;
 }
 
 static inline bool iscdata(lua_State *L, int idx) {
-    auto *p = static_cast<ctype *>(luaL_testudata(L, idx, lua::CFFI_CDATA_MT));
+    auto *p = static_cast<ctype *>(lua::testcval(L, idx));
     return p && (p->ct_tag != lua::CFFI_CTYPE_TAG);
 }
 
 static inline bool isctype(lua_State *L, int idx) {
-    auto *p = static_cast<ctype *>(luaL_testudata(L, idx, lua::CFFI_CDATA_MT));
+    auto *p = static_cast<ctype *>(lua::testcval(L, idx));
     return p && (p->ct_tag == lua::CFFI_CTYPE_TAG);
 }
 
 static inline bool iscval(lua_State *L, int idx) {
-    return luaL_testudata(L, idx, lua::CFFI_CDATA_MT);
+    return lua::testcval(L, idx);
 }
 
 template<typename T>
@@ -287,10 +406,8 @@ static inline bool isctype(cdata<T> const &cd) {
 
 template<typename T>
 static inline cdata<T> &checkcdata(lua_State *L, int idx) {
-    auto ret = static_cast<cdata<T> *>(
-        luaL_checkudata(L, idx, lua::CFFI_CDATA_MT)
-    );
-    if (isctype(*ret)) {
+    auto ret = static_cast<cdata<T> *>(lua::testcval(L, idx));
+    if (!ret || isctype(*ret)) {
         lua::type_error(L, idx, "cdata");
     }
     return *ret;
@@ -298,9 +415,7 @@ static inline cdata<T> &checkcdata(lua_State *L, int idx) {
 
 template<typename T>
 static inline cdata<T> *testcdata(lua_State *L, int idx) {
-    auto ret = static_cast<cdata<T> *>(
-        luaL_testudata(L, idx, lua::CFFI_CDATA_MT)
-    );
+    auto ret = static_cast<cdata<T> *>(lua::testcval(L, idx));
     if (!ret || isctype(*ret)) {
         return nullptr;
     }
@@ -326,10 +441,15 @@ static inline size_t cdata_value_size(lua_State *L, int idx) {
     }
 }
 
-void destroy_cdata(lua_State *L, cdata<ffi::noval> &cd);
+void destroy_cdata(lua_State *L, int idx);
 void destroy_closure(closure_data *cd);
 
-int call_cif(cdata<fdata> &fud, lua_State *L, size_t largs);
+/* calls the function with `largs` arguments from the Lua stack; if `rdst`
+ * is given, the result is written there instead of being pushed
+ */
+int call_cif(
+    cdata<fdata> &fud, lua_State *L, size_t largs, void *rdst = nullptr
+);
 
 enum conv_rule {
     RULE_CONV = 0,
@@ -367,22 +487,25 @@ void set_global(lua_State *L, lib::c_lib const *dl, char const *sname, int idx);
 
 void make_cdata(lua_State *L, ast::c_type const &decl, int rule, int idx);
 
-static inline bool metatype_getfield(lua_State *L, int mt, char const *fname) {
-    luaL_getmetatable(L, lua::CFFI_CDATA_MT);
-    lua_getfield(L, -1, "__ffi_metatypes");
-    lua_rawgeti(L, -1, mt);
-    if (lua_istable(L, -1)) {
-        lua_getfield(L, -1, fname);
-        if (!lua_isnil(L, -1)) {
-            lua_insert(L, -4);
-            lua_pop(L, 3);
-            return true;
-        } else {
-            lua_pop(L, 1);
-        }
+/* records shared with other states keep their metatypes in our store */
+static inline ast::c_metatype const *record_metatype(
+    lua_State *L, ast::c_record const &rec
+) {
+    if (!rec.frozen()) {
+        return rec.metatype();
     }
-    lua_pop(L, 3);
-    return false;
+    return ast::decl_store::get_main(L).metatype(rec);
+}
+
+/* pushes the metamethod if the metatype has it */
+static inline bool metatype_getfield(
+    lua_State *L, ast::c_metatype const *mt, metatype_flag flag
+) {
+    if (!mt || !(mt->flags & flag)) {
+        return false;
+    }
+    lua_rawgeti(L, LUA_REGISTRYINDEX, mt->fields[metafield_idx(flag)]);
+    return true;
 }
 
 template<typename T>
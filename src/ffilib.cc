@@ -1,6 +1,16 @@
 #include <cstdlib>
 #include <cstring>
+#include <cstdint>
 #include <cerrno>
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "platform.hh"
 #include "parser.hh"
@@ -8,6 +18,9 @@
 #include "lib.hh"
 #include "lua.hh"
 #include "ffi.hh"
+#include "pool.hh"
+#include "shm.hh"
+#include "stats.hh"
 
 /* sets up the metatable for library, i.e. the individual namespaces
  * of loaded shared libraries as well as the primary C namespace.
@@ -74,33 +87,28 @@ struct lib_meta {
  */
 struct cdata_meta {
     static int gc(lua_State *L) {
-        ffi::destroy_cdata(L, ffi::tocdata<ffi::noval>(L, 1));
+        ffi::destroy_cdata(L, 1);
         return 0;
     }
 
-    static int metatype_getmt(lua_State *L, int idx, int &mflags) {
+    static ast::c_metatype const *metatype_getmt(lua_State *L, int idx) {
         auto &cd = ffi::tocdata<ffi::noval>(L, idx);
         auto *decl = &cd.decl;
         auto tp = decl->type();
         if (tp == ast::C_BUILTIN_RECORD) {
-            return cd.decl.record().metatype(mflags);
+            return ffi::record_metatype(L, cd.decl.record());
         } else if ((tp == ast::C_BUILTIN_PTR) || (tp == ast::C_BUILTIN_REF)) {
             if (cd.decl.ptr_base().type() != ast::C_BUILTIN_RECORD) {
-                return LUA_REFNIL;
+                return nullptr;
             }
-            return cd.decl.ptr_base().record().metatype(mflags);
+            return ffi::record_metatype(L, cd.decl.ptr_base().record());
         }
-        return LUA_REFNIL;
+        return nullptr;
     }
 
     template<ffi::metatype_flag flag>
     static inline bool metatype_check(lua_State *L, int idx) {
-        int mflags = 0;
-        int mtp = metatype_getmt(L, idx, mflags);
-        if (!(mflags & flag)) {
-            return false;
-        }
-        return ffi::metatype_getfield(L, mtp, ffi::metafield_name(flag));
+        return ffi::metatype_getfield(L, metatype_getmt(L, idx), flag);
     }
 
     static int tostring(lua_State *L) {
@@ -251,12 +259,63 @@ struct cdata_meta {
         }
         luaL_unref(L, LUA_REGISTRYINDEX, cd.val.cd->fref);
         lua_pushvalue(L, 2);
+        stats::count(stats::REF_CALLBACK);
         cd.val.cd->fref = luaL_ref(L, LUA_REGISTRYINDEX);
         return 0;
     }
 
+    /* fn:into(dst, ...) calls fn and stores the result in dst */
+    static int call_into(lua_State *L) {
+        auto &fd = ffi::checkcdata<ffi::fdata>(L, 1);
+        if (!fd.decl.callable()) {
+            lua::type_error(L, 1, "function");
+        }
+        if (fd.decl.closure() && !fd.val.cd) {
+            luaL_error(L, "bad callback");
+        }
+        auto &rtp = fd.decl.function().result();
+        auto &dst = ffi::checkcdata<void *>(L, 2);
+        void *addr = nullptr;
+        if (dst.decl.is_same(rtp, true)) {
+            addr = &dst.val;
+        } else if ((
+            (dst.decl.type() == ast::C_BUILTIN_PTR) ||
+            (dst.decl.type() == ast::C_BUILTIN_REF)
+        ) && dst.decl.ptr_base().is_same(rtp, true)) {
+            addr = dst.val;
+        }
+        if (!addr || (rtp.type() == ast::C_BUILTIN_VOID)) {
+            lua_pushfstring(
+                L, "cannot store '%s' into '%s'", rtp.serialize().c_str(),
+                dst.decl.serialize().c_str()
+            );
+            luaL_argcheck(L, false, 2, lua_tostring(L, -1));
+        }
+        /* move the destination out of the way of the arguments */
+        lua_pushvalue(L, 2);
+        lua_remove(L, 2);
+        size_t largs = size_t(lua_gettop(L) - 2);
+        /* call_cif would take a missing argument from the destination */
+        auto &pdecls = fd.decl.function().params();
+        if (largs < pdecls.size()) {
+            luaL_error(
+                L, "cannot convert 'no value' to '%s'",
+                pdecls[largs].type().serialize().c_str()
+            );
+        }
+        ffi::call_cif(fd, L, largs, addr);
+        lua_settop(L, int(largs) + 2);
+        return 1;
+    }
+
     static int index(lua_State *L) {
         auto &cd = ffi::tocdata<ffi::noval>(L, 1);
+        if (cd.decl.callable() && (lua_type(L, 2) == LUA_TSTRING)) {
+            if (!strcmp(lua_tostring(L, 2), "into")) {
+                lua_pushcfunction(L, call_into);
+                return 1;
+            }
+        }
         if (cd.decl.closure()) {
             /* callbacks have some methods */
             char const *mname = lua_tostring(L, 2);
@@ -293,6 +352,7 @@ struct cdata_meta {
             return 1;
         };
         if (metatype_check<ffi::METATYPE_FLAG_INDEX>(L, 1)) {
+            ffi::trace(L, ffi::TRACE_METATYPE_INDEX);
             /* if __index is a function, call it */
             if (lua_isfunction(L, -1)) {
                 /* __index takes 2 args, put it to the beginning and call */
@@ -317,11 +377,16 @@ struct cdata_meta {
     static int newindex(lua_State *L) {
         if (index_common(L, [L](auto &decl, void *val) {
             size_t rsz;
-            ffi::from_lua(L, decl, val, 3, rsz, ffi::RULE_CONV);
+            void *rp = ffi::from_lua(L, decl, val, 3, rsz, ffi::RULE_CONV);
+            /* cdata sources are not copied into the storage */
+            if (rp != val) {
+                memcpy(val, rp, rsz);
+            }
         })) {
             return 0;
         };
         if (metatype_check<ffi::METATYPE_FLAG_NEWINDEX>(L, 1)) {
+            ffi::trace(L, ffi::TRACE_METATYPE_INDEX);
             lua_insert(L, 1);
             lua_call(L, 3, 0);
             return 0;
@@ -334,13 +399,69 @@ struct cdata_meta {
         return 0;
     }
 
+    /* typed access for pointers to and arrays of scalars, anything but
+     * numeric keys and values goes through the generic path
+     */
+    template<typename T>
+    static void typed_push(lua_State *L, ffi::cdata<T *> &cd, T const *p) {
+#if LUA_VERSION_NUM < 503
+        using LT = lua_Number;
+#else
+        using LT = lua_Integer;
+#endif
+        if (std::is_floating_point<T>::value) {
+            if (
+                std::numeric_limits<T>::max() <=
+                std::numeric_limits<lua_Number>::max()
+            ) {
+                lua_pushnumber(L, lua_Number(*p));
+                return;
+            }
+        } else if (
+            std::numeric_limits<T>::digits <= std::numeric_limits<LT>::digits
+        ) {
+            lua_pushinteger(L, lua_Integer(*p));
+            return;
+        }
+        /* may have to be boxed */
+        ffi::to_lua(L, cd.decl.ptr_base(), p, ffi::RULE_CONV);
+    }
+
+    template<typename T>
+    static int typed_index(lua_State *L) {
+        if (lua_type(L, 2) != LUA_TNUMBER) {
+            return index(L);
+        }
+        auto &cd = ffi::tocdata<T *>(L, 1);
+        typed_push(L, cd, cd.val + ptrdiff_t(lua_tointeger(L, 2)));
+        return 1;
+    }
+
+    template<typename T>
+    static int typed_newindex(lua_State *L) {
+        if (
+            (lua_type(L, 2) != LUA_TNUMBER) || (lua_type(L, 3) != LUA_TNUMBER)
+        ) {
+            return newindex(L);
+        }
+        auto &cd = ffi::tocdata<T *>(L, 1);
+        T *p = cd.val + ptrdiff_t(lua_tointeger(L, 2));
+        if (std::is_floating_point<T>::value) {
+            *p = T(lua_tonumber(L, 3));
+        } else {
+            *p = T(lua_tointeger(L, 3));
+        }
+        return 0;
+    }
+
     template<ffi::metatype_flag mtype>
     static inline bool unop_try_mt(
         lua_State *L, ffi::cdata<void *> *cd, int rvals = 1
     ) {
         /* custom metatypes, either operand */
         if (cd && metatype_check<mtype>(L, 1)) {
-            lua_insert(L, 1);
+            /* unary metamethods may get the operand twice */
+            lua_pushvalue(L, 1);
             lua_call(L, 1, rvals);
             return true;
         }
@@ -460,35 +581,108 @@ struct cdata_meta {
         }
     }
 
-    static ast::c_value arith_64bit_base(
-        lua_State *L, ast::c_expr_binop op, ast::c_expr_type &retp
+    /* typed kernels for 64-bit arithmetic
+     *
+     * after promotion both sides are either signed or unsigned 64-bit
+     * integers, so every operation is a single switch for either type;
+     * addition, subtraction and multiplication wrap around like in LuaJIT
+     */
+    template<typename T>
+    static T arith_64bit_op(ast::c_expr_binop op, T lhs, T rhs) {
+        using U = unsigned long long;
+        switch (op) {
+            case ast::c_expr_binop::ADD: return T(U(lhs) + U(rhs));
+            case ast::c_expr_binop::SUB: return T(U(lhs) - U(rhs));
+            case ast::c_expr_binop::MUL: return T(U(lhs) * U(rhs));
+            case ast::c_expr_binop::DIV: return lhs / rhs;
+            case ast::c_expr_binop::MOD: return lhs % rhs;
+            case ast::c_expr_binop::BAND: return lhs & rhs;
+            case ast::c_expr_binop::BOR: return lhs | rhs;
+            case ast::c_expr_binop::BXOR: return lhs ^ rhs;
+            default: break;
+        }
+        assert(false);
+        return T(0);
+    }
+
+    template<typename T>
+    static T arith_64bit_op(ast::c_expr_unop op, T val) {
+        using U = unsigned long long;
+        switch (op) {
+            case ast::c_expr_unop::UNM: return T(U(0) - U(val));
+            case ast::c_expr_unop::BNOT: return ~val;
+            default: break;
+        }
+        assert(false);
+        return T(0);
+    }
+
+    template<typename T>
+    static bool cmp_64bit_op(ast::c_expr_binop op, T lhs, T rhs) {
+        switch (op) {
+            case ast::c_expr_binop::EQ: return lhs == rhs;
+            case ast::c_expr_binop::LT: return lhs < rhs;
+            case ast::c_expr_binop::LE: return lhs <= rhs;
+            default: break;
+        }
+        assert(false);
+        return false;
+    }
+
+    /* shifts work like the operators of LuaJIT: a negative signed count
+     * shifts the other way, an unsigned count is taken as it is, and
+     * counts past the width shift all bits out (signed right shifts fill
+     * the value with its sign)
+     */
+    template<typename T>
+    static T shift_64bit_op(
+        ast::c_expr_binop op, T val, ast::c_expr_type ct,
+        ast::c_value const &cnt
     ) {
-        ast::c_expr bexp{ast::C_TYPE_WEAK}, lhs, rhs;
-        ast::c_expr_type lt = ffi::check_arith_expr(L, 1, lhs.val);
-        ast::c_expr_type rt = ffi::check_arith_expr(L, 2, rhs.val);
-        promote_sides(lt, lhs.val, rt, rhs.val);
-        lhs.type(lt);
-        rhs.type(rt);
-        bexp.type(ast::c_expr_type::BINARY);
-        bexp.bin.op = op;
-        bexp.bin.lhs = &lhs;
-        bexp.bin.rhs = &rhs;
-        return bexp.eval(retp, true);
+        using U = unsigned long long;
+        bool left = (op == ast::c_expr_binop::LSH);
+        U n = cnt.ull;
+        if ((ct != ast::c_expr_type::ULLONG) && (cnt.ll < 0)) {
+            left = !left;
+            n = U(0) - U(cnt.ll);
+        }
+        if (left) {
+            return (n < 64) ? T(U(val) << n) : T(0);
+        }
+        if (std::is_signed<T>::value) {
+            return val >> ((n < 64) ? n : 63);
+        }
+        return (n < 64) ? T(val >> n) : T(0);
+    }
+
+    /* the result goes directly into a cdata of the promoted type */
+    template<typename T>
+    static void push_64bit(lua_State *L, T val) {
+        ffi::newcdata<T>(L, ast::c_type{ast::builtin_v<T>, 0}).val = val;
     }
 
     static void arith_64bit_bin(lua_State *L, ast::c_expr_binop op) {
-        /* regular arithmetic */
-        ast::c_expr_type retp;
-        auto rv = arith_64bit_base(L, op, retp);
-        ffi::make_cdata_arith(L, retp, rv);
+        ast::c_value lhs, rhs;
+        ast::c_expr_type lt = ffi::check_arith_expr(L, 1, lhs);
+        ast::c_expr_type rt = ffi::check_arith_expr(L, 2, rhs);
+        promote_sides(lt, lhs, rt, rhs);
+        if (lt == ast::c_expr_type::ULLONG) {
+            push_64bit(L, arith_64bit_op(op, lhs.ull, rhs.ull));
+        } else {
+            push_64bit(L, arith_64bit_op(op, lhs.ll, rhs.ll));
+        }
     }
 
     static void arith_64bit_cmp(lua_State *L, ast::c_expr_binop op) {
-        /* comparison */
-        ast::c_expr_type retp;
-        auto rv = arith_64bit_base(L, op, retp);
-        assert(retp == ast::c_expr_type::BOOL);
-        lua_pushboolean(L, rv.b);
+        ast::c_value lhs, rhs;
+        ast::c_expr_type lt = ffi::check_arith_expr(L, 1, lhs);
+        ast::c_expr_type rt = ffi::check_arith_expr(L, 2, rhs);
+        promote_sides(lt, lhs, rt, rhs);
+        if (lt == ast::c_expr_type::ULLONG) {
+            lua_pushboolean(L, cmp_64bit_op(op, lhs.ull, rhs.ull));
+        } else {
+            lua_pushboolean(L, cmp_64bit_op(op, lhs.ll, rhs.ll));
+        }
     }
 
     static int add(lua_State *L) {
@@ -512,7 +706,7 @@ struct cdata_meta {
             }
             auto *p = static_cast<unsigned char *>(cd1->val);
             auto &ret = ffi::newcdata<void *>(L, cd1->decl);
-            ret.val = p + d;
+            ret.val = p + d * ptrdiff_t(asize);
             return 1;
         } else if (cd2 && (cd2->decl.type() == ast::C_BUILTIN_PTR)) {
             size_t asize = cd2->decl.ptr_base().alloc_size();
@@ -531,7 +725,7 @@ struct cdata_meta {
             }
             auto *p = static_cast<unsigned char *>(cd2->val);
             auto &ret = ffi::newcdata<void *>(L, cd2->decl);
-            ret.val = d + p;
+            ret.val = d * ptrdiff_t(asize) + p;
             return 1;
         }
         if (binop_try_mt<ffi::METATYPE_FLAG_ADD>(L, cd1, cd2)) {
@@ -578,7 +772,7 @@ struct cdata_meta {
             }
             auto *p = static_cast<unsigned char *>(cd1->val);
             auto &ret = ffi::newcdata<void *>(L, cd1->decl);
-            ret.val = p + d;
+            ret.val = p - d * ptrdiff_t(asize);
             return 1;
         }
         if (binop_try_mt<ffi::METATYPE_FLAG_SUB>(L, cd1, cd2)) {
@@ -649,18 +843,15 @@ struct cdata_meta {
         if (unop_try_mt<mflag>(L, cd)) {
             return 1;
         }
-        ast::c_expr uexp{ast::C_TYPE_WEAK}, exp;
-        ast::c_expr_type et = ffi::check_arith_expr(L, 1, exp.val);
+        ast::c_value val;
+        ast::c_expr_type et = ffi::check_arith_expr(L, 1, val);
         promote_long(et);
-        if (et != ast::c_expr_type::ULLONG) {
-            promote_to_64bit<long long, ast::c_expr_type::LLONG>(et, &exp.val);
+        if (et == ast::c_expr_type::ULLONG) {
+            push_64bit(L, arith_64bit_op(uop, val.ull));
+            return 1;
         }
-        exp.type(et);
-        uexp.type(ast::c_expr_type::UNARY);
-        uexp.un.op = uop;
-        uexp.un.expr = &exp;
-        auto rv = uexp.eval(et, true);
-        ffi::make_cdata_arith(L, et, rv);
+        promote_to_64bit<long long, ast::c_expr_type::LLONG>(et, &val);
+        push_64bit(L, arith_64bit_op(uop, val.ll));
         return 1;
     }
 
@@ -808,23 +999,23 @@ struct cdata_meta {
         if (binop_try_mt<mflag>(L, cd1, cd2)) {
             return 1;
         }
-        ast::c_expr_type retp;
-        ast::c_expr bexp{ast::C_TYPE_WEAK}, lhs, rhs;
-        ast::c_expr_type lt = ffi::check_arith_expr(L, 1, lhs.val);
-        ast::c_expr_type rt = ffi::check_arith_expr(L, 2, rhs.val);
-        /* we're only promoting the left side in shifts */
+        ast::c_value lhs, rhs;
+        ast::c_expr_type lt = ffi::check_arith_expr(L, 1, lhs);
+        ast::c_expr_type rt = ffi::check_arith_expr(L, 2, rhs);
+        /* we're only promoting the left side in shifts, the count keeps
+         * its signedness so that negative counts shift the other way
+         */
         promote_long(lt);
-        if (lt != ast::c_expr_type::ULLONG) {
-            promote_to_64bit<long long, ast::c_expr_type::LLONG>(lt, &lhs.val);
+        promote_long(rt);
+        if (rt != ast::c_expr_type::ULLONG) {
+            promote_to_64bit<long long, ast::c_expr_type::LLONG>(rt, &rhs);
+        }
+        if (lt == ast::c_expr_type::ULLONG) {
+            push_64bit(L, shift_64bit_op(bop, lhs.ull, rt, rhs));
+            return 1;
         }
-        lhs.type(lt);
-        rhs.type(rt);
-        bexp.type(ast::c_expr_type::BINARY);
-        bexp.bin.op = bop;
-        bexp.bin.lhs = &lhs;
-        bexp.bin.rhs = &rhs;
-        auto rv = bexp.eval(retp, true);
-        ffi::make_cdata_arith(L, retp, rv);
+        promote_to_64bit<long long, ast::c_expr_type::LLONG>(lt, &lhs);
+        push_64bit(L, shift_64bit_op(bop, lhs.ll, rt, rhs));
         return 1;
     }
 #endif /* LUA_VERSION_NUM > 502 */
@@ -834,6 +1025,10 @@ struct cdata_meta {
         if (!luaL_newmetatable(L, lua::CFFI_CDATA_MT)) {
             luaL_error(L, "unexpected error: registry reinitialized");
         }
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &lua::CFFI_CDATA_MT_KEY);
+        lua_pushboolean(L, true);
+        lua_rawsetp(L, -2, &lua::CFFI_CDATA_MT_KEY);
 
         lua_pushliteral(L, "ffi");
         lua_setfield(L, -2, "__metatable");
@@ -953,174 +1148,1827 @@ struct cdata_meta {
 #endif /* LUA_VERSION_NUM > 502 */
 #endif /* LUA_VERSION_NUM > 501 */
 
+        setup_typed<ast::C_BUILTIN_CHAR>(L);
+        setup_typed<ast::C_BUILTIN_SCHAR>(L);
+        setup_typed<ast::C_BUILTIN_UCHAR>(L);
+        setup_typed<ast::C_BUILTIN_SHORT>(L);
+        setup_typed<ast::C_BUILTIN_USHORT>(L);
+        setup_typed<ast::C_BUILTIN_INT>(L);
+        setup_typed<ast::C_BUILTIN_UINT>(L);
+        setup_typed<ast::C_BUILTIN_LONG>(L);
+        setup_typed<ast::C_BUILTIN_ULONG>(L);
+        setup_typed<ast::C_BUILTIN_LLONG>(L);
+        setup_typed<ast::C_BUILTIN_ULLONG>(L);
+        setup_typed<ast::C_BUILTIN_FLOAT>(L);
+        setup_typed<ast::C_BUILTIN_DOUBLE>(L);
+
         lua_pop(L, 1);
     }
-};
 
-/* the ffi module itself */
-struct ffi_module {
-    static int cdef_f(lua_State *L) {
-        parser::parse(L, luaL_checkstring(L, 1), (lua_gettop(L) > 1) ? 2 : -1);
-        return 0;
+    /* a copy of the common metatable (on top of the stack) with typed
+     * __index and __newindex for pointers to and arrays of the type
+     */
+    template<ast::c_builtin B>
+    static void setup_typed(lua_State *L) {
+        using T = ast::builtin_t<B>;
+        lua_newtable(L);
+        lua_pushnil(L);
+        while (lua_next(L, -3)) {
+            lua_pushvalue(L, -2);
+            lua_insert(L, -2);
+            lua_rawset(L, -4);
+        }
+        lua_pushcfunction(L, typed_index<T>);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, typed_newindex<T>);
+        lua_setfield(L, -2, "__newindex");
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &ffi::scalar_mt_keys[B]);
     }
+};
 
-    /* either gets a ctype or makes a ctype from a string */
-    static ast::c_type const &check_ct(
-        lua_State *L, int idx, int paridx = -1
-    ) {
-        if (ffi::iscval(L, idx)) {
-            auto &cd = ffi::tocdata<ffi::noval>(L, idx);
-            if (ffi::isctype(cd)) {
-                return cd.decl;
-            }
-            auto &ct = ffi::newctype(L, cd.decl);
-            lua_replace(L, idx);
-            return ct.decl;
+/* either gets a ctype or makes a ctype from a string */
+static ast::c_type const &check_ct(lua_State *L, int idx, int paridx = -1) {
+    if (ffi::iscval(L, idx)) {
+        auto &cd = ffi::tocdata<ffi::noval>(L, idx);
+        if (ffi::isctype(cd)) {
+            return cd.decl;
         }
-        auto &ct = ffi::newctype(
-            L, parser::parse_type(L, luaL_checkstring(L, idx), paridx)
-        );
+        auto &ct = ffi::newctype(L, cd.decl);
         lua_replace(L, idx);
         return ct.decl;
     }
+    auto &ct = ffi::newctype(
+        L, parser::parse_type(L, luaL_checkstring(L, idx), paridx)
+    );
+    lua_replace(L, idx);
+    return ct.decl;
+}
 
-    static int new_f(lua_State *L) {
-        ffi::make_cdata(L, check_ct(L, 1), ffi::RULE_CONV, 2);
-        return 1;
-    }
+/* struct-of-arrays containers
+ *
+ * the userdata consists of the header, followed by a descriptor for each
+ * field of the record and then the columns themselves, each one aligned
+ * for its element type; rows are small proxies that refer to the container
+ * and keep it alive through their user value
+ */
+struct soa_column {
+    char const *name;
+    ast::c_type const *type;
+    unsigned char *data;
+    size_t esize;
+};
 
-    static int cast_f(lua_State *L) {
-        luaL_checkany(L, 2);
-        ffi::make_cdata(L, check_ct(L, 1), ffi::RULE_CAST, 2);
-        return 1;
+struct soa_data {
+    ast::c_type decl;
+    size_t nelems;
+    size_t ncols;
+
+    soa_column *cols() {
+        return reinterpret_cast<soa_column *>(this + 1);
     }
+};
 
-    static int metatype_f(lua_State *L) {
-        auto &ct = check_ct(L, 1);
-        luaL_argcheck(
-            L, ct.type() == ast::C_BUILTIN_RECORD, 1,
-            "invalid C type"
+struct soa_row {
+    soa_data *soa;
+    size_t idx;
+};
+
+struct soa_meta {
+    static soa_data &check_soa(lua_State *L, int idx) {
+        return *static_cast<soa_data *>(
+            luaL_checkudata(L, idx, lua::CFFI_SOA_MT)
         );
-        int mflags;
-        if (ct.record().metatype(mflags) != LUA_REFNIL) {
-            luaL_error(L, "cannot change a protected metatable");
-        }
-        luaL_checktype(L, 2, LUA_TTABLE);
+    }
 
-#define FIELD_CHECK(fname, flagn) { \
-            lua_getfield(L, 2, "__" fname); \
-            if (!lua_isnil(L, -1)) { \
-                mflags |= ffi::METATYPE_FLAG_##flagn; \
-            } \
-            lua_pop(L, 1); \
+    static soa_column &check_col(lua_State *L, soa_data &sd, int idx) {
+        char const *fname = luaL_checkstring(L, idx);
+        auto *cols = sd.cols();
+        for (size_t i = 0; i < sd.ncols; ++i) {
+            if (!strcmp(cols[i].name, fname)) {
+                return cols[i];
+            }
         }
+        luaL_error(
+            L, "'%s' has no member named '%s'",
+            sd.decl.serialize().c_str(), fname
+        );
+        return cols[0];
+    }
 
-        FIELD_CHECK("add", ADD)
-        FIELD_CHECK("sub", SUB)
-        FIELD_CHECK("mul", MUL)
-        FIELD_CHECK("div", DIV)
-        FIELD_CHECK("mod", MOD)
-        FIELD_CHECK("pow", POW)
-        FIELD_CHECK("unm", UNM)
-        FIELD_CHECK("concat", CONCAT)
-        FIELD_CHECK("len", LEN)
-        FIELD_CHECK("eq", EQ)
-        FIELD_CHECK("lt", LT)
-        FIELD_CHECK("le", LE)
-        FIELD_CHECK("index", INDEX)
-        FIELD_CHECK("newindex", NEWINDEX)
-        FIELD_CHECK("call", CALL)
-        FIELD_CHECK("gc", GC)
-        FIELD_CHECK("tostring", TOSTRING)
+    static size_t check_idx(lua_State *L, soa_data &sd, int idx) {
+        auto i = luaL_checkinteger(L, idx);
+        if ((i < 0) || (size_t(i) >= sd.nelems)) {
+            luaL_error(L, "index out of bounds");
+        }
+        return size_t(i);
+    }
 
-#if LUA_VERSION_NUM > 501
-        FIELD_CHECK("pairs", PAIRS)
+    static void get_elem(lua_State *L, soa_column &col, size_t i) {
+        void *val = &col.data[i * col.esize];
+        void *pp = val;
+        if (col.type->type() == ast::C_BUILTIN_ARRAY) {
+            pp = &val;
+        }
+        if (!ffi::to_lua(L, *col.type, pp, ffi::RULE_CONV)) {
+            luaL_error(L, "invalid C type");
+        }
+    }
 
-#if LUA_VERSION_NUM == 502
-        FIELD_CHECK("ipairs", IPAIRS)
-#endif
+    static void set_elem(lua_State *L, soa_column &col, size_t i, int vidx) {
+        size_t rsz;
+        ffi::from_lua(
+            L, *col.type, &col.data[i * col.esize], vidx, rsz,
+            ffi::RULE_CONV
+        );
+    }
 
-#if LUA_VERSION_NUM > 502
-        FIELD_CHECK("idiv", IDIV)
-        FIELD_CHECK("band", BAND)
-        FIELD_CHECK("bor", BOR)
-        FIELD_CHECK("bxor", BXOR)
-        FIELD_CHECK("bnot", BNOT)
-        FIELD_CHECK("shl", SHL)
-        FIELD_CHECK("shr", SHR)
-#endif /* LUA_VERSION_NUM > 502 */
-#endif /* LUA_VERSION_NUM > 501 */
+    static int gc(lua_State *L) {
+        using T = ast::c_type;
+        lua::touserdata<soa_data>(L, 1)->decl.~T();
+        return 0;
+    }
 
-#undef FIELD_CHECK
+    static int len(lua_State *L) {
+        lua_pushinteger(L, lua_Integer(check_soa(L, 1).nelems));
+        return 1;
+    }
 
-        /* get the metatypes table on the stack */
-        luaL_getmetatable(L, lua::CFFI_CDATA_MT);
-        lua_getfield(L, -1, "__ffi_metatypes");
-        /* the metatype */
-        lua_pushvalue(L, 2);
-        const_cast<ast::c_record &>(ct.record()).metatype(
-            luaL_ref(L, -2), mflags
+    static int tostring(lua_State *L) {
+        auto &sd = check_soa(L, 1);
+        lua_pushfstring(
+            L, "soa<%s>: %p", sd.decl.serialize().c_str(),
+            static_cast<void *>(&sd)
         );
+        return 1;
+    }
 
+    static int column(lua_State *L) {
+        auto &sd = check_soa(L, 1);
+        auto &col = check_col(L, sd, 2);
+        auto &cd = ffi::newcdata<void *>(
+            L, ast::c_type{*col.type, 0}
+        );
+        cd.val = col.data;
+        /* the column pointer keeps the container alive */
         lua_pushvalue(L, 1);
-        return 1; /* return the ctype */
+        cd.aux = luaL_ref(L, LUA_REGISTRYINDEX);
+        return 1;
     }
 
-    static int load_f(lua_State *L) {
-        char const *path = luaL_checkstring(L, 1);
-        bool glob = (lua_gettop(L) >= 2) && lua_toboolean(L, 2);
-        auto *c_ud = lua::newuserdata<lib::c_lib>(L);
-        lib::load(c_ud, path, L, glob);
+    static int get(lua_State *L) {
+        auto &sd = check_soa(L, 1);
+        size_t i = check_idx(L, sd, 2);
+        get_elem(L, check_col(L, sd, 3), i);
         return 1;
     }
 
-    static int typeof_f(lua_State *L) {
-        check_ct(L, 1, (lua_gettop(L) > 1) ? 2 : -1);
-        return 1;
+    static int set(lua_State *L) {
+        auto &sd = check_soa(L, 1);
+        size_t i = check_idx(L, sd, 2);
+        luaL_checkany(L, 4);
+        set_elem(L, check_col(L, sd, 3), i, 4);
+        return 0;
     }
 
-    static int addressof_f(lua_State *L) {
-        auto &cd = ffi::checkcdata<void *>(L, 1);
-        if (cd.decl.type() == ast::C_BUILTIN_REF) {
-            /* refs/arrays are turned into pointers with the same addr */
-            ffi::newcdata<void *>(
-                L, cd.decl.as_type(ast::C_BUILTIN_PTR)
-            ).val = cd.val;
-        } else {
-            /* otherwise just make a cdata pointing to whatever it was */
-            ffi::newcdata<void *>(L, ast::c_type{cd.decl, 0}).val = &cd.val;
+    static int index(lua_State *L) {
+        auto &sd = check_soa(L, 1);
+        if (lua_type(L, 2) != LUA_TNUMBER) {
+            /* methods */
+            lua_pushvalue(L, 2);
+            lua_rawget(L, lua_upvalueindex(1));
+            if (lua_isnil(L, -1)) {
+                luaL_error(
+                    L, "'%s' has no member named '%s'",
+                    sd.decl.serialize().c_str(), lua_tostring(L, 2)
+                );
+            }
+            return 1;
         }
+        size_t i = check_idx(L, sd, 2);
+        auto *row = lua::newuserdata<soa_row>(L);
+        row->soa = &sd;
+        row->idx = i;
+        luaL_setmetatable(L, lua::CFFI_SOA_ROW_MT);
+        lua_getuservalue(L, 1);
+        lua_setuservalue(L, -2);
         return 1;
     }
 
-    static int gc_f(lua_State *L) {
-        auto &cd = ffi::checkcdata<ffi::noval>(L, 1);
-        if (lua_isnil(L, 2)) {
-            /* if nil and there is an existing finalizer, unset */
-            if (cd.gc_ref != LUA_REFNIL) {
-                luaL_unref(L, LUA_REGISTRYINDEX, cd.gc_ref);
-                cd.gc_ref = LUA_REFNIL;
-            }
-        } else {
-            /* new finalizer can be any type, it's pcall'd */
-            lua_pushvalue(L, 2);
-            cd.gc_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-        }
-        lua_pushvalue(L, 1); /* return the cdata */
+    static int row_index(lua_State *L) {
+        auto *row = lua::touserdata<soa_row>(L, 1);
+        get_elem(L, check_col(L, *row->soa, 2), row->idx);
         return 1;
     }
 
-    static int sizeof_f(lua_State *L) {
-        if (ffi::iscdata(L, 1)) {
-            lua_pushinteger(L, ffi::cdata_value_size(L, 1));
-            return 1;
-        }
-        auto &ct = check_ct(L, 1);
-        if (ct.vla()) {
-            size_t sz = 0;
-            if (lua_isinteger(L, 2)) {
-                auto isz = lua_tointeger(L, 2);
-                if (isz < 0) {
+    static int row_newindex(lua_State *L) {
+        auto *row = lua::touserdata<soa_row>(L, 1);
+        set_elem(L, check_col(L, *row->soa, 2), row->idx, 3);
+        return 0;
+    }
+
+    static int row_tostring(lua_State *L) {
+        auto *row = lua::touserdata<soa_row>(L, 1);
+        lua_pushfstring(
+            L, "soa<%s>: %p [%d]", row->soa->decl.serialize().c_str(),
+            static_cast<void *>(row->soa), int(row->idx)
+        );
+        return 1;
+    }
+
+    static void make(lua_State *L, ast::c_type const &ct, size_t n) {
+        if (
+            (ct.type() != ast::C_BUILTIN_RECORD) ||
+            ct.record().is_union() || ct.record().opaque()
+        ) {
+            luaL_error(
+                L, "'%s' is not a complete struct type",
+                ct.serialize().c_str()
+            );
+        }
+        size_t ncols = 0, dsize = 0;
+        ct.record().iter_fields([L, n, &ncols, &dsize](
+            char const *, ast::c_type const &fld, size_t
+        ) {
+            if (fld.unbounded() || fld.vla()) {
+                luaL_error(L, "struct-of-arrays cannot have flexible members");
+            }
+            ++ncols;
+            size_t esize = fld.alloc_size();
+            size_t align = fld.libffi_type()->alignment;
+            size_t maxs = std::numeric_limits<size_t>::max();
+            if (esize && (n > ((maxs - align - dsize) / esize))) {
+                luaL_error(L, "struct-of-arrays size too large");
+            }
+            /* worst case padding to get the column aligned */
+            dsize += esize * n + align;
+            return false;
+        });
+        size_t hsize = sizeof(soa_data) + ncols * sizeof(soa_column);
+        if (dsize > (std::numeric_limits<size_t>::max() - hsize)) {
+            luaL_error(L, "struct-of-arrays size too large");
+        }
+        auto *sd = static_cast<soa_data *>(lua_newuserdata(L, hsize + dsize));
+        new (&sd->decl) ast::c_type{ct};
+        sd->nelems = n;
+        sd->ncols = ncols;
+        auto *cols = sd->cols();
+        auto *dp = reinterpret_cast<unsigned char *>(sd) + hsize;
+        ct.record().iter_fields([n, &cols, &dp](
+            char const *fname, ast::c_type const &fld, size_t
+        ) {
+            size_t align = fld.libffi_type()->alignment;
+            size_t pad = reinterpret_cast<uintptr_t>(dp) % align;
+            if (pad) {
+                dp += align - pad;
+            }
+            cols->name = fname;
+            cols->type = &fld;
+            cols->data = dp;
+            cols->esize = fld.alloc_size();
+            memset(dp, 0, cols->esize * n);
+            dp += cols->esize * n;
+            ++cols;
+            return false;
+        });
+        luaL_setmetatable(L, lua::CFFI_SOA_MT);
+        /* rows anchor the container through this */
+        lua_createtable(L, 1, 0);
+        lua_pushvalue(L, -2);
+        lua_rawseti(L, -2, 1);
+        lua_setuservalue(L, -2);
+    }
+
+    static void setup(lua_State *L) {
+        if (!luaL_newmetatable(L, lua::CFFI_SOA_MT)) {
+            luaL_error(L, "unexpected error: registry reinitialized");
+        }
+
+        lua_pushliteral(L, "ffi");
+        lua_setfield(L, -2, "__metatable");
+
+        lua_pushcfunction(L, gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, len);
+        lua_setfield(L, -2, "__len");
+
+        lua_pushcfunction(L, tostring);
+        lua_setfield(L, -2, "__tostring");
+
+        lua_newtable(L);
+        lua_pushcfunction(L, column);
+        lua_setfield(L, -2, "column");
+        lua_pushcfunction(L, get);
+        lua_setfield(L, -2, "get");
+        lua_pushcfunction(L, set);
+        lua_setfield(L, -2, "set");
+        lua_pushcclosure(L, index, 1);
+        lua_setfield(L, -2, "__index");
+
+        lua_pop(L, 1);
+
+        if (!luaL_newmetatable(L, lua::CFFI_SOA_ROW_MT)) {
+            luaL_error(L, "unexpected error: registry reinitialized");
+        }
+
+        lua_pushliteral(L, "ffi");
+        lua_setfield(L, -2, "__metatable");
+
+        lua_pushcfunction(L, row_index);
+        lua_setfield(L, -2, "__index");
+
+        lua_pushcfunction(L, row_newindex);
+        lua_setfield(L, -2, "__newindex");
+
+        lua_pushcfunction(L, row_tostring);
+        lua_setfield(L, -2, "__tostring");
+
+        lua_pop(L, 1);
+    }
+};
+
+/* cursors walk a buffer without allocating a new pointer cdata per step
+ *
+ * the cursor keeps the object it was created from alive through its user
+ * value; when created with a length, all reads are bounds checked
+ */
+struct cursor_data {
+    ast::c_type decl; /* element type */
+    unsigned char *base;
+    unsigned char *ptr;
+    size_t len;
+};
+
+struct cursor_meta {
+    static cursor_data &check_cursor(lua_State *L, int idx) {
+        return *static_cast<cursor_data *>(
+            luaL_checkudata(L, idx, lua::CFFI_CURSOR_MT)
+        );
+    }
+
+    static unsigned char *check_avail(
+        lua_State *L, cursor_data &cur, size_t n
+    ) {
+        size_t off = size_t(cur.ptr - cur.base);
+        if ((cur.len != SIZE_MAX) && ((off > cur.len) || (n > cur.len - off))) {
+            luaL_error(L, "attempt to read past the end of the buffer");
+        }
+        auto *ret = cur.ptr;
+        cur.ptr += n;
+        return ret;
+    }
+
+    /* scalars are copied out first as the position may be unaligned */
+    static void read_value(
+        lua_State *L, ast::c_type const &tp, void const *p, int rule
+    ) {
+        ffi::arg_stor_t stor;
+        size_t sz = tp.alloc_size();
+        if (tp.type() == ast::C_BUILTIN_ARRAY) {
+            memcpy(&stor, &p, sizeof(void *));
+            p = &stor;
+        } else if (
+            (tp.type() != ast::C_BUILTIN_RECORD) && (sz <= sizeof(stor))
+        ) {
+            memcpy(&stor, p, sz);
+            p = &stor;
+        }
+        if (!ffi::to_lua(L, tp, p, rule)) {
+            luaL_error(L, "invalid C type");
+        }
+    }
+
+    static int gc(lua_State *L) {
+        using T = ast::c_type;
+        lua::touserdata<cursor_data>(L, 1)->decl.~T();
+        return 0;
+    }
+
+    static int tostring(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        lua_pushfstring(
+            L, "cursor<%s>: %p", cur.decl.serialize().c_str(),
+            static_cast<void *>(cur.ptr)
+        );
+        return 1;
+    }
+
+    static int next(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        size_t esz = cur.decl.alloc_size();
+        if (!esz) {
+            luaL_error(
+                L, "attempt to read an incomplete type '%s'",
+                cur.decl.serialize().c_str()
+            );
+        }
+        read_value(L, cur.decl, check_avail(L, cur, esz), ffi::RULE_CONV);
+        return 1;
+    }
+
+    static int read(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        auto &ct = check_ct(L, 2);
+        size_t esz = ct.alloc_size();
+        if (!esz || (ct.type() == ast::C_BUILTIN_FUNC)) {
+            luaL_argcheck(L, false, 2, "invalid C type");
+        }
+        read_value(L, ct, check_avail(L, cur, esz), ffi::RULE_RET);
+        return 1;
+    }
+
+    static int skip(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        auto n = luaL_checkinteger(L, 2);
+        if (n < 0) {
+            /* negated in unsigned arithmetic, as -n overflows for the
+             * smallest integer
+             */
+            size_t back = size_t(0) - size_t(n);
+            if (back > size_t(cur.ptr - cur.base)) {
+                luaL_error(L, "attempt to seek before the beginning");
+            }
+            cur.ptr -= back;
+        } else {
+            check_avail(L, cur, size_t(n));
+        }
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    static int ptr(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        ffi::newcdata<void *>(L, ast::c_type{cur.decl, 0}).val = cur.ptr;
+        return 1;
+    }
+
+    static int offset(lua_State *L) {
+        auto &cur = check_cursor(L, 1);
+        lua_pushinteger(L, lua_Integer(cur.ptr - cur.base));
+        return 1;
+    }
+
+    static void make(
+        lua_State *L, ast::c_type const &tp, void *p, size_t len, int aidx
+    ) {
+        auto *cur = lua::newuserdata<cursor_data>(L);
+        new (&cur->decl) ast::c_type{tp};
+        cur->base = cur->ptr = static_cast<unsigned char *>(p);
+        cur->len = len;
+        luaL_setmetatable(L, lua::CFFI_CURSOR_MT);
+        lua_createtable(L, 1, 0);
+        lua_pushvalue(L, aidx);
+        lua_rawseti(L, -2, 1);
+        lua_setuservalue(L, -2);
+    }
+
+    static void setup(lua_State *L) {
+        if (!luaL_newmetatable(L, lua::CFFI_CURSOR_MT)) {
+            luaL_error(L, "unexpected error: registry reinitialized");
+        }
+
+        lua_pushliteral(L, "ffi");
+        lua_setfield(L, -2, "__metatable");
+
+        lua_pushcfunction(L, gc);
+        lua_setfield(L, -2, "__gc");
+
+        lua_pushcfunction(L, tostring);
+        lua_setfield(L, -2, "__tostring");
+
+        lua_newtable(L);
+        lua_pushcfunction(L, next);
+        lua_setfield(L, -2, "next");
+        lua_pushcfunction(L, read);
+        lua_setfield(L, -2, "read");
+        lua_pushcfunction(L, skip);
+        lua_setfield(L, -2, "skip");
+        lua_pushcfunction(L, ptr);
+        lua_setfield(L, -2, "ptr");
+        lua_pushcfunction(L, offset);
+        lua_setfield(L, -2, "offset");
+        lua_setfield(L, -2, "__index");
+
+        lua_pop(L, 1);
+    }
+};
+
+/* atomic operations on memory referenced by cdata; a std::atomic of the
+ * same width is laid over the memory (like C++20 std::atomic_ref would do),
+ * which is only done for lock-free widths so that it also works across
+ * processes sharing the memory
+ */
+struct atomic_ops {
+    enum op_type {
+        OP_LOAD = 0,
+        OP_STORE,
+        OP_ADD,
+        OP_SUB,
+        OP_AND,
+        OP_OR,
+        OP_XOR,
+        OP_XCHG,
+        OP_CAS
+    };
+
+    struct target {
+        void *addr;
+        ast::c_type const *type;
+        int vidx; /* first value argument */
+    };
+
+    static target get_target(lua_State *L, op_type op) {
+        auto &cd = ffi::checkcdata<void *>(L, 1);
+        target t{nullptr, nullptr, 2};
+        auto const *decl = &cd.decl;
+        if (ffi::isctype(cd) || decl->callable()) {
+            lua::type_error(L, 1, "data cdata");
+        }
+        /* for all of these the value is the address of the pointee */
+        bool ptr = (decl->type() == ast::C_BUILTIN_PTR) ||
+            (decl->type() == ast::C_BUILTIN_REF) ||
+            (decl->type() == ast::C_BUILTIN_ARRAY);
+        auto const *base = ptr ? &decl->ptr_base() : decl;
+        void *paddr = cd.val;
+        if (
+            (decl->type() == ast::C_BUILTIN_REF) &&
+            (base->type() == ast::C_BUILTIN_ARRAY)
+        ) {
+            /* references to arrays go through the array's own pointer */
+            paddr = cd.get_deref_addr();
+            base = &base->ptr_base();
+        }
+        if (
+            (base->type() == ast::C_BUILTIN_RECORD) &&
+            (lua_type(L, 2) == LUA_TSTRING)
+        ) {
+            /* a field of a record */
+            auto foff = base->record().field_offset(
+                lua_tostring(L, 2), t.type
+            );
+            if (foff < 0) {
+                luaL_error(
+                    L, "'%s' has no member named '%s'",
+                    base->serialize().c_str(), lua_tostring(L, 2)
+                );
+            }
+            t.addr = static_cast<unsigned char *>(
+                ptr ? paddr : cd.get_addr()
+            ) + foff;
+            t.vidx = 3;
+        } else if (ptr) {
+            t.addr = paddr;
+            t.type = base;
+        } else {
+            lua::type_error(L, 1, "pointer, reference, array or record");
+        }
+        auto &tp = *t.type;
+        size_t sz = tp.alloc_size();
+        bool ok = (tp.arith() || (tp.type() == ast::C_BUILTIN_PTR)) && (
+            (sz == 1) || (sz == 2) || (sz == 4) || (sz == 8)
+        );
+        if (ok && (op >= OP_ADD) && (op <= OP_XOR)) {
+            ok = tp.integer() && (tp.type() != ast::C_BUILTIN_BOOL);
+        }
+        if (!ok) {
+            luaL_error(
+                L, "invalid atomic operand type '%s'",
+                tp.serialize().c_str()
+            );
+        }
+        if ((op != OP_LOAD) && (tp.cv() & ast::C_CV_CONST)) {
+            luaL_error(
+                L, "atomic write to a constant '%s'", tp.serialize().c_str()
+            );
+        }
+        if (!t.addr || (reinterpret_cast<uintptr_t>(t.addr) % sz)) {
+            luaL_error(L, "invalid or misaligned atomic operand");
+        }
+        return t;
+    }
+
+    static std::memory_order get_order(lua_State *L, int idx, op_type op) {
+        static char const *const names[] = {
+            "relaxed", "consume", "acquire", "release", "acq_rel", "seq_cst",
+            nullptr
+        };
+        static std::memory_order const orders[] = {
+            std::memory_order_relaxed, std::memory_order_consume,
+            std::memory_order_acquire, std::memory_order_release,
+            std::memory_order_acq_rel, std::memory_order_seq_cst
+        };
+        auto mo = orders[luaL_checkoption(L, idx, "seq_cst", names)];
+        bool ok = true;
+        if (op == OP_LOAD) {
+            ok = (mo != std::memory_order_release) &&
+                (mo != std::memory_order_acq_rel);
+        } else if (op == OP_STORE) {
+            ok = (mo == std::memory_order_relaxed) ||
+                (mo == std::memory_order_release) ||
+                (mo == std::memory_order_seq_cst);
+        }
+        luaL_argcheck(L, ok, idx, "invalid memory order for the operation");
+        return mo;
+    }
+
+    template<typename T>
+    static bool do_op(
+        op_type op, void *addr, void const *val, void const *exp,
+        void *out, std::memory_order mo
+    ) {
+        static_assert(
+            sizeof(std::atomic<T>) == sizeof(T), "atomic size mismatch"
+        );
+        auto &a = *static_cast<std::atomic<T> *>(addr);
+        T v{}, r{};
+        if (val) {
+            memcpy(&v, val, sizeof(T));
+        }
+        switch (op) {
+            case OP_LOAD: r = a.load(mo); break;
+            case OP_STORE: a.store(v, mo); return true;
+            case OP_ADD: r = a.fetch_add(v, mo); break;
+            case OP_SUB: r = a.fetch_sub(v, mo); break;
+            case OP_AND: r = a.fetch_and(v, mo); break;
+            case OP_OR: r = a.fetch_or(v, mo); break;
+            case OP_XOR: r = a.fetch_xor(v, mo); break;
+            case OP_XCHG: r = a.exchange(v, mo); break;
+            case OP_CAS: {
+                memcpy(&r, exp, sizeof(T));
+                bool ret = a.compare_exchange_strong(r, v, mo);
+                memcpy(out, &r, sizeof(T));
+                return ret;
+            }
+        }
+        memcpy(out, &r, sizeof(T));
+        return true;
+    }
+
+    template<typename T>
+    static bool lock_free(void *addr) {
+        return static_cast<std::atomic<T> *>(addr)->is_lock_free();
+    }
+
+    template<op_type op>
+    static int atomic_f(lua_State *L) {
+        auto t = get_target(L, op);
+        int nvals = (op == OP_LOAD) ? 0 : ((op == OP_CAS) ? 2 : 1);
+        ffi::arg_stor_t vstor, estor, out;
+        void const *val = nullptr, *exp = nullptr;
+        size_t vsz;
+        if (op == OP_CAS) {
+            exp = ffi::from_lua(
+                L, *t.type, &estor, t.vidx, vsz, ffi::RULE_CONV
+            );
+            val = ffi::from_lua(
+                L, *t.type, &vstor, t.vidx + 1, vsz, ffi::RULE_CONV
+            );
+        } else if (nvals) {
+            val = ffi::from_lua(
+                L, *t.type, &vstor, t.vidx, vsz, ffi::RULE_CONV
+            );
+        }
+        auto mo = get_order(L, t.vidx + nvals, op);
+        bool ret = false, lf = false;
+        switch (t.type->alloc_size()) {
+#define ATOMIC_CASE(sz, T) case sz: \
+                lf = lock_free<T>(t.addr); \
+                if (lf) { \
+                    ret = do_op<T>(op, t.addr, val, exp, &out, mo); \
+                } \
+                break;
+            ATOMIC_CASE(1, uint8_t)
+            ATOMIC_CASE(2, uint16_t)
+            ATOMIC_CASE(4, uint32_t)
+            ATOMIC_CASE(8, uint64_t)
+#undef ATOMIC_CASE
+            default:
+                break;
+        }
+        if (!lf) {
+            luaL_error(
+                L, "atomic operations on '%s' are not lock-free",
+                t.type->serialize().c_str()
+            );
+        }
+        switch (op) {
+            case OP_STORE:
+                return 0;
+            case OP_CAS:
+                lua_pushboolean(L, ret);
+                ffi::to_lua(L, *t.type, &out, ffi::RULE_RET);
+                return 2;
+            default:
+                break;
+        }
+        ffi::to_lua(L, *t.type, &out, ffi::RULE_RET);
+        return 1;
+    }
+
+    static void setup(lua_State *L) {
+        static luaL_Reg const atomic_def[] = {
+            {"load", atomic_f<OP_LOAD>},
+            {"store", atomic_f<OP_STORE>},
+            {"add", atomic_f<OP_ADD>},
+            {"sub", atomic_f<OP_SUB>},
+            {"band", atomic_f<OP_AND>},
+            {"bor", atomic_f<OP_OR>},
+            {"bxor", atomic_f<OP_XOR>},
+            {"exchange", atomic_f<OP_XCHG>},
+            {"cas", atomic_f<OP_CAS>},
+            {NULL, NULL}
+        };
+        luaL_newlib(L, atomic_def);
+        /* plain names too; these are keywords, so only usable as strings */
+        lua_getfield(L, -1, "band");
+        lua_setfield(L, -2, "and");
+        lua_getfield(L, -1, "bor");
+        lua_setfield(L, -2, "or");
+        lua_getfield(L, -1, "bxor");
+        lua_setfield(L, -2, "xor");
+    }
+};
+
+/* the call profiler; the data lives in the registry for the whole life
+ * of the state and calls only look it up while it is running
+ */
+struct profile_ops {
+    static ffi::profile_data &get(lua_State *L) {
+        lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_PROFILE);
+        auto *pd = lua::touserdata<ffi::profile_data>(L, -1);
+        lua_pop(L, 1);
+        return *pd;
+    }
+
+    static int start_f(lua_State *L) {
+        get(L).start();
+        return 0;
+    }
+
+    static int stop_f(lua_State *L) {
+        get(L).stop();
+        return 0;
+    }
+
+    struct report_entry {
+        std::string const *name;
+        ffi::profile_entry const *ent;
+        bool callback;
+    };
+
+    static void push_time(lua_State *L, uint64_t ns, char const *fname) {
+        lua_pushnumber(L, lua_Number(ns) / 1e9);
+        lua_setfield(L, -2, fname);
+    }
+
+    static int report_f(lua_State *L) {
+        auto &pd = get(L);
+        std::vector<report_entry> ents;
+        for (auto &p: pd.calls) {
+            ents.push_back(report_entry{&p.first, &p.second, false});
+        }
+        for (auto &p: pd.callbacks) {
+            ents.push_back(report_entry{&p.first, &p.second, true});
+        }
+        /* the most expensive ones come first */
+        std::sort(
+            ents.begin(), ents.end(),
+            [](report_entry const &a, report_entry const &b) {
+                auto at = a.ent->call_ns + a.ent->args_ns + a.ent->ret_ns;
+                auto bt = b.ent->call_ns + b.ent->args_ns + b.ent->ret_ns;
+                return at > bt;
+            }
+        );
+        lua_createtable(L, int(ents.size()), 0);
+        int idx = 1;
+        for (auto &e: ents) {
+            lua_createtable(L, 0, 7);
+            lua_pushlstring(L, e.name->data(), e.name->size());
+            lua_setfield(L, -2, "name");
+            lua_pushboolean(L, e.callback);
+            lua_setfield(L, -2, "callback");
+            lua_pushinteger(L, lua_Integer(e.ent->calls));
+            lua_setfield(L, -2, "calls");
+            push_time(L, e.ent->call_ns, "time");
+            push_time(L, e.ent->max_ns, "max");
+            push_time(L, e.ent->args_ns, "args");
+            push_time(L, e.ent->ret_ns, "ret");
+            lua_rawseti(L, -2, idx++);
+        }
+        return 1;
+    }
+
+    static void setup(lua_State *L) {
+        static luaL_Reg const profile_def[] = {
+            {"start", start_f},
+            {"stop", stop_f},
+            {"report", report_f},
+            {NULL, NULL}
+        };
+        luaL_newlib(L, profile_def);
+    }
+};
+
+/* the conversion tracer, set up like the profiler */
+struct trace_ops {
+    static ffi::trace_data &get(lua_State *L) {
+        lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_TRACE);
+        auto *td = lua::touserdata<ffi::trace_data>(L, -1);
+        lua_pop(L, 1);
+        return *td;
+    }
+
+    static int start_f(lua_State *L) {
+        get(L).start();
+        return 0;
+    }
+
+    static int stop_f(lua_State *L) {
+        get(L).stop();
+        return 0;
+    }
+
+    struct report_entry {
+        std::string const *name;
+        ffi::trace_site const *site;
+        size_t total;
+    };
+
+    static int report_f(lua_State *L) {
+        static char const *const names[] = {
+            "ptr_convert", "str_copy", "box", "unbox", "table_init",
+            "metatype_index"
+        };
+        static_assert(
+            (sizeof(names) / sizeof(names[0])) == ffi::TRACE_MAX,
+            "trace event names out of sync"
+        );
+        auto &td = get(L);
+        std::vector<report_entry> ents;
+        for (auto &p: td.sites) {
+            size_t total = 0;
+            for (auto c: p.second.counts) {
+                total += c;
+            }
+            ents.push_back(report_entry{&p.first, &p.second, total});
+        }
+        /* the hottest call sites first */
+        std::sort(
+            ents.begin(), ents.end(),
+            [](report_entry const &a, report_entry const &b) {
+                return a.total > b.total;
+            }
+        );
+        lua_createtable(L, int(ents.size()), 0);
+        int idx = 1;
+        for (auto &e: ents) {
+            lua_createtable(L, 0, 2);
+            lua_pushlstring(L, e.name->data(), e.name->size());
+            lua_setfield(L, -2, "site");
+            lua_pushinteger(L, lua_Integer(e.total));
+            lua_setfield(L, -2, "count");
+            for (int i = 0; i < ffi::TRACE_MAX; ++i) {
+                if (e.site->counts[i]) {
+                    lua_pushinteger(L, lua_Integer(e.site->counts[i]));
+                    lua_setfield(L, -2, names[i]);
+                }
+            }
+            lua_rawseti(L, -2, idx++);
+        }
+        return 1;
+    }
+
+    static void setup(lua_State *L) {
+        static luaL_Reg const trace_def[] = {
+            {"start", start_f},
+            {"stop", stop_f},
+            {"report", report_f},
+            {NULL, NULL}
+        };
+        luaL_newlib(L, trace_def);
+    }
+};
+
+/* serialization of C values to and from Lua strings
+ *
+ * a type is compiled into a flat list of operations, one for each scalar
+ * (or character array) plus a pair for each nested record or array; plans
+ * for records are cached in the registry, keyed by the record itself
+ */
+struct pack_op {
+    enum kind_t: unsigned char {
+        LEAF = 0, STRING, ENTER, LEAVE
+    } kind;
+    /* the field name, or null for array elements */
+    char const *name;
+    /* 1-based index for array elements, 0 for the root */
+    size_t idx;
+    /* null for the root, whose type may be collected while the plan is
+     * cached; the type being packed is used for it instead
+     */
+    ast::c_type const *type;
+    size_t size;
+    /* the offset in memory, and in the packed encoding */
+    size_t off;
+    size_t poff;
+};
+
+struct pack_plan {
+    size_t nops;
+    size_t size;
+    size_t psize;
+
+    pack_op *ops() {
+        return reinterpret_cast<pack_op *>(this + 1);
+    }
+};
+
+struct pack_ops {
+    struct compile_state {
+        pack_op *ops;
+        size_t nops;
+        size_t poff;
+    };
+
+    static void emit(
+        compile_state &cs, pack_op::kind_t kind, char const *name,
+        size_t idx, ast::c_type const *tp, size_t size, size_t off
+    ) {
+        if (cs.ops) {
+            cs.ops[cs.nops] = pack_op{
+                kind, name, idx, (name || idx) ? tp : nullptr, size, off,
+                cs.poff
+            };
+        }
+        ++cs.nops;
+        if ((kind == pack_op::LEAF) || (kind == pack_op::STRING)) {
+            cs.poff += size;
+        }
+    }
+
+    static void compile(
+        lua_State *L, compile_state &cs, ast::c_type const &tp,
+        char const *name, size_t idx, size_t off
+    ) {
+        switch (tp.type()) {
+            case ast::C_BUILTIN_BOOL:
+            case ast::C_BUILTIN_CHAR:
+            case ast::C_BUILTIN_SCHAR:
+            case ast::C_BUILTIN_UCHAR:
+            case ast::C_BUILTIN_SHORT:
+            case ast::C_BUILTIN_USHORT:
+            case ast::C_BUILTIN_INT:
+            case ast::C_BUILTIN_UINT:
+            case ast::C_BUILTIN_LONG:
+            case ast::C_BUILTIN_ULONG:
+            case ast::C_BUILTIN_LLONG:
+            case ast::C_BUILTIN_ULLONG:
+            case ast::C_BUILTIN_FLOAT:
+            case ast::C_BUILTIN_DOUBLE:
+            case ast::C_BUILTIN_ENUM:
+                emit(cs, pack_op::LEAF, name, idx, &tp, tp.alloc_size(), off);
+                return;
+            case ast::C_BUILTIN_ARRAY: {
+                if (tp.unbounded() || tp.vla()) {
+                    break;
+                }
+                auto &base = tp.ptr_base();
+                if (base.type() == ast::C_BUILTIN_CHAR) {
+                    emit(
+                        cs, pack_op::STRING, name, idx, &tp,
+                        tp.array_size(), off
+                    );
+                    return;
+                }
+                size_t esz = base.alloc_size();
+                emit(cs, pack_op::ENTER, name, idx, &tp, 0, off);
+                for (size_t i = 0; i < tp.array_size(); ++i) {
+                    compile(L, cs, base, nullptr, i + 1, off + i * esz);
+                }
+                emit(cs, pack_op::LEAVE, name, idx, &tp, 0, off);
+                return;
+            }
+            case ast::C_BUILTIN_RECORD: {
+                auto &rec = tp.record();
+                if (rec.opaque() || rec.is_union()) {
+                    break;
+                }
+                emit(cs, pack_op::ENTER, name, idx, &tp, 0, off);
+                rec.iter_fields([L, &cs, off](
+                    char const *fname, ast::c_type const &ftp, size_t foff
+                ) {
+                    compile(L, cs, ftp, fname, 0, off + foff);
+                    return false;
+                });
+                emit(cs, pack_op::LEAVE, name, idx, &tp, 0, off);
+                return;
+            }
+            default:
+                break;
+        }
+        luaL_error(L, "cannot pack '%s'", tp.serialize().c_str());
+    }
+
+    static ast::c_type const &op_ctype(
+        pack_op const &op, ast::c_type const &root
+    ) {
+        return op.type ? *op.type : root;
+    }
+
+    /* pushes the plan for the type */
+    static pack_plan &get_plan(lua_State *L, ast::c_type const &tp) {
+        bool rec = (tp.type() == ast::C_BUILTIN_RECORD);
+        if (rec) {
+            lua_getfield(L, LUA_REGISTRYINDEX, lua::CFFI_PACK_PLANS);
+            lua_rawgetp(L, -1, &tp.record());
+            if (!lua_isnil(L, -1)) {
+                lua_replace(L, -2);
+                return *lua::touserdata<pack_plan>(L, -1);
+            }
+            lua_pop(L, 1);
+        }
+        /* count and check first so that nothing leaks on errors */
+        compile_state cs{nullptr, 0, 0};
+        compile(L, cs, tp, nullptr, 0, 0);
+        auto *pp = lua::newuserdata<pack_plan>(L, cs.nops * sizeof(pack_op));
+        pp->nops = cs.nops;
+        pp->size = tp.alloc_size();
+        pp->psize = cs.poff;
+        cs = compile_state{pp->ops(), 0, 0};
+        compile(L, cs, tp, nullptr, 0, 0);
+        if (rec) {
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, -3, &tp.record());
+            lua_replace(L, -2);
+        }
+        return *pp;
+    }
+
+    struct options {
+        bool swap = false;
+        bool packed = false;
+    };
+
+    static options get_options(lua_State *L, int idx) {
+        options ret;
+        if (lua_isnoneornil(L, idx)) {
+            return ret;
+        }
+        luaL_checktype(L, idx, LUA_TTABLE);
+        lua_getfield(L, idx, "endian");
+        if (!lua_isnil(L, -1)) {
+            char const *en = lua_tostring(L, -1);
+            bool big;
+            if (en && !strcmp(en, "big")) {
+                big = true;
+            } else if (en && !strcmp(en, "little")) {
+                big = false;
+            } else if (en && !strcmp(en, "native")) {
+#ifdef FFI_BIG_ENDIAN
+                big = true;
+#else
+                big = false;
+#endif
+            } else {
+                luaL_argerror(L, idx, "invalid byte order");
+                return ret;
+            }
+#ifdef FFI_BIG_ENDIAN
+            ret.swap = !big;
+#else
+            ret.swap = big;
+#endif
+        }
+        lua_getfield(L, idx, "packed");
+        ret.packed = lua_toboolean(L, -1);
+        lua_pop(L, 2);
+        return ret;
+    }
+
+    static void copy_scalar(
+        unsigned char *dst, unsigned char const *src, size_t n, bool swap
+    ) {
+        if (!swap) {
+            memcpy(dst, src, n);
+            return;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst[i] = src[n - i - 1];
+        }
+    }
+
+    /* gets the value of the op from the container on top of the stack */
+    static void get_value(lua_State *L, pack_op const &op, int vidx) {
+        if (!op.name && !op.idx) {
+            lua_pushvalue(L, vidx);
+            return;
+        }
+        if (lua_type(L, -1) != LUA_TTABLE) {
+            lua_pushnil(L);
+        } else if (op.name) {
+            lua_getfield(L, -1, op.name);
+        } else {
+            lua_rawgeti(L, -1, lua_Integer(op.idx));
+        }
+    }
+
+    static void set_value(lua_State *L, pack_op const &op) {
+        if (op.name) {
+            lua_setfield(L, -2, op.name);
+        } else if (op.idx) {
+            lua_rawseti(L, -2, lua_Integer(op.idx));
+        }
+    }
+
+    /* the memory of a cdata of the type (or a pointer or ref to it) */
+    static unsigned char const *test_mem(
+        lua_State *L, int idx, ast::c_type const &tp
+    ) {
+        auto *cd = ffi::testcdata<void *>(L, idx);
+        if (!cd || ffi::isctype(*cd)) {
+            return nullptr;
+        }
+        if (cd->decl.is_same(tp, true)) {
+            if (tp.type() == ast::C_BUILTIN_ARRAY) {
+                return static_cast<unsigned char const *>(cd->val);
+            }
+            return reinterpret_cast<unsigned char const *>(&cd->val);
+        }
+        auto ctp = cd->decl.type();
+        if (
+            ((ctp == ast::C_BUILTIN_PTR) || (ctp == ast::C_BUILTIN_REF)) &&
+            cd->decl.ptr_base().is_same(tp, true)
+        ) {
+            return static_cast<unsigned char const *>(cd->val);
+        }
+        return nullptr;
+    }
+
+    static int pack_f(lua_State *L) {
+        auto &tp = check_ct(L, 1);
+        luaL_checkany(L, 2);
+        auto opts = get_options(L, 3);
+        auto &pp = get_plan(L, tp);
+        size_t osz = opts.packed ? pp.psize : pp.size;
+        auto *out = static_cast<unsigned char *>(lua_newuserdata(L, osz));
+        memset(out, 0, osz);
+        auto *ops = pp.ops();
+        auto *mem = test_mem(L, 2, tp);
+        if (mem) {
+            for (size_t i = 0; i < pp.nops; ++i) {
+                auto &op = ops[i];
+                auto *dst = out + (opts.packed ? op.poff : op.off);
+                if (op.kind == pack_op::LEAF) {
+                    copy_scalar(dst, mem + op.off, op.size, opts.swap);
+                } else if (op.kind == pack_op::STRING) {
+                    memcpy(dst, mem + op.off, op.size);
+                }
+            }
+            lua_pushlstring(L, reinterpret_cast<char *>(out), osz);
+            return 1;
+        }
+        /* containers are kept on the stack while walking */
+        lua_pushnil(L);
+        for (size_t i = 0; i < pp.nops; ++i) {
+            auto &op = ops[i];
+            auto *dst = out + (opts.packed ? op.poff : op.off);
+            if (op.kind == pack_op::LEAVE) {
+                lua_pop(L, 1);
+                continue;
+            }
+            get_value(L, op, 2);
+            if (op.kind == pack_op::ENTER) {
+                /* nil containers are left zeroed */
+                if (!lua_isnil(L, -1) && (lua_type(L, -1) != LUA_TTABLE)) {
+                    luaL_error(
+                        L, "invalid value for '%s'",
+                        op_ctype(op, tp).serialize().c_str()
+                    );
+                }
+                continue;
+            }
+            if (lua_isnil(L, -1)) {
+                lua_pop(L, 1);
+                continue;
+            }
+            if (op.kind == pack_op::STRING) {
+                if (lua_type(L, -1) != LUA_TSTRING) {
+                    luaL_error(
+                        L, "invalid value for '%s'",
+                        op_ctype(op, tp).serialize().c_str()
+                    );
+                }
+                size_t slen;
+                char const *s = lua_tolstring(L, -1, &slen);
+                if (slen > op.size) {
+                    luaL_error(
+                        L, "string too long for '%s'",
+                        op_ctype(op, tp).serialize().c_str()
+                    );
+                }
+                memcpy(dst, s, slen);
+            } else {
+                ffi::arg_stor_t stor;
+                size_t rsz;
+                void *rp = ffi::from_lua(
+                    L, op_ctype(op, tp), &stor, -1, rsz, ffi::RULE_CONV
+                );
+                copy_scalar(
+                    dst, static_cast<unsigned char const *>(rp), op.size,
+                    opts.swap
+                );
+            }
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        lua_pushlstring(L, reinterpret_cast<char *>(out), osz);
+        return 1;
+    }
+
+    static int unpack_f(lua_State *L) {
+        auto &tp = check_ct(L, 1);
+        size_t slen;
+        auto *str = reinterpret_cast<unsigned char const *>(
+            luaL_checklstring(L, 2, &slen)
+        );
+        size_t off = 0;
+        if (!lua_isnoneornil(L, 3)) {
+            off = ffi::check_arith<size_t>(L, 3);
+        }
+        auto opts = get_options(L, 4);
+        auto &pp = get_plan(L, tp);
+        size_t isz = opts.packed ? pp.psize : pp.size;
+        if ((off > slen) || (isz > (slen - off))) {
+            luaL_error(L, "data string too short");
+        }
+        str += off;
+        auto *ops = pp.ops();
+        /* the root container, if any, ends up on top */
+        lua_pushnil(L);
+        for (size_t i = 0; i < pp.nops; ++i) {
+            auto &op = ops[i];
+            auto *src = str + (opts.packed ? op.poff : op.off);
+            switch (op.kind) {
+                case pack_op::ENTER:
+                    lua_newtable(L);
+                    continue;
+                case pack_op::LEAVE:
+                    if (op.name || op.idx) {
+                        set_value(L, op);
+                    }
+                    continue;
+                case pack_op::STRING: {
+                    auto *e = static_cast<unsigned char const *>(
+                        memchr(src, '\0', op.size)
+                    );
+                    lua_pushlstring(
+                        L, reinterpret_cast<char const *>(src),
+                        e ? size_t(e - src) : op.size
+                    );
+                    break;
+                }
+                default: {
+                    ffi::arg_stor_t stor;
+                    copy_scalar(
+                        reinterpret_cast<unsigned char *>(&stor), src,
+                        op.size, opts.swap
+                    );
+                    ffi::to_lua(L, op_ctype(op, tp), &stor, ffi::RULE_CONV);
+                    break;
+                }
+            }
+            set_value(L, op);
+        }
+        lua_pushinteger(L, lua_Integer(off + isz));
+        return 2;
+    }
+};
+
+/* handles passed between states, see cffi.freeze and cffi.detach
+ *
+ * handles are light userdata, which any state can hold, so every live
+ * handle is kept in a process-wide table; a handle is only used after
+ * it is found there, and the table owns whatever has not been taken
+ */
+
+/* a payload detached from a cdata; it lives outside of the Lua heap and
+ * is finalized by plain C functions, so it does not depend on any state
+ */
+struct transfer_data {
+    void *data;
+    void (*fin)(void *);
+};
+
+static void finalize_transfer(transfer_data *td) {
+    td->fin(td->data);
+    free(td);
+}
+
+struct handle_table {
+    static handle_table &get() {
+        static handle_table ht;
+        return ht;
+    }
+
+    ~handle_table() {
+        /* payloads nobody adopted; this runs during static destruction,
+         * when the library a finalizer came from may be gone already, so
+         * only our own records are freed and the data is left alone
+         */
+        for (auto *td: p_transfers) {
+            free(td);
+        }
+    }
+
+    void add_transfer(transfer_data *td) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        p_transfers.insert(td);
+    }
+
+    bool has_transfer(transfer_data *td) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        return p_transfers.count(td);
+    }
+
+    /* the caller owns the payload if this succeeds */
+    bool take_transfer(transfer_data *td) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        return p_transfers.erase(td);
+    }
+
+    /* the handle of a frozen store keeps a reference to it until it is
+     * released; freezing the same store again gives the same handle
+     */
+    void *add_store(std::shared_ptr<ast::decl_store> ds) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        void *h = ds.get();
+        p_stores.emplace(h, std::move(ds));
+        return h;
+    }
+
+    std::shared_ptr<ast::decl_store> get_store(void *h) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        auto it = p_stores.find(h);
+        if (it == p_stores.end()) {
+            return nullptr;
+        }
+        return it->second;
+    }
+
+    bool release_store(void *h) {
+        std::lock_guard<std::mutex> l{p_mtx};
+        return p_stores.erase(h);
+    }
+
+private:
+    std::mutex p_mtx{};
+    std::unordered_set<transfer_data *> p_transfers{};
+    std::unordered_map<void *, std::shared_ptr<ast::decl_store>> p_stores{};
+};
+
+/* the ffi module itself */
+struct ffi_module {
+    static int cdef_f(lua_State *L) {
+        size_t len;
+        char const *src = luaL_checklstring(L, 1, &len);
+        auto &ds = ast::decl_store::get_main(L);
+        size_t ndecls = ds.size();
+        auto t0 = std::chrono::steady_clock::now();
+        parser::parse(L, src, (lua_gettop(L) > 1) ? 2 : -1);
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - t0
+        ).count();
+        ds.parsed(ast::parse_record{
+            uint64_t(ns), ds.size() - ndecls, len
+        });
+        return 0;
+    }
+
+    static int freeze_f(lua_State *L) {
+        auto ds = ast::decl_store::get_main(L).freeze();
+        lua_pushlightuserdata(L, handle_table::get().add_store(std::move(ds)));
+        return 1;
+    }
+
+    static int attach_f(lua_State *L) {
+        luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+        auto ds = handle_table::get().get_store(lua_touserdata(L, 1));
+        if (!ds) {
+            luaL_argerror(L, 1, "invalid handle");
+        }
+        char const *conflict;
+        if (ast::decl_store::get_main(L).attach(*ds, conflict)) {
+            return 0;
+        }
+        /* Lua errors may not unwind the C++ stack, so the reference is
+         * dropped first; the conflicting name may belong to the store,
+         * so the message is made before that
+         */
+        if (conflict) {
+            lua_pushfstring(L, "'%s' redefined", conflict);
+        } else {
+            lua_pushliteral(
+                L, "a different declaration store is already attached"
+            );
+        }
+        ds.reset();
+        luaL_where(L, 1);
+        lua_insert(L, -2);
+        lua_concat(L, 2);
+        return lua_error(L);
+    }
+
+    static int new_f(lua_State *L) {
+        ffi::make_cdata(L, check_ct(L, 1), ffi::RULE_CONV, 2);
+        return 1;
+    }
+
+    static int cast_f(lua_State *L) {
+        luaL_checkany(L, 2);
+        ffi::make_cdata(L, check_ct(L, 1), ffi::RULE_CAST, 2);
+        return 1;
+    }
+
+    static int metatype_f(lua_State *L) {
+        auto &ct = check_ct(L, 1);
+        luaL_argcheck(
+            L, ct.type() == ast::C_BUILTIN_RECORD, 1,
+            "invalid C type"
+        );
+        if (ffi::record_metatype(L, ct.record())) {
+            luaL_error(L, "cannot change a protected metatable");
+        }
+        luaL_checktype(L, 2, LUA_TTABLE);
+
+        ast::c_metatype mt;
+
+#define FIELD_CHECK(fname, flagn) { \
+            lua_getfield(L, 2, "__" fname); \
+            if (!lua_isnil(L, -1)) { \
+                mt.flags |= ffi::METATYPE_FLAG_##flagn; \
+                mt.fields[ffi::metafield_idx(ffi::METATYPE_FLAG_##flagn)] = \
+                    luaL_ref(L, LUA_REGISTRYINDEX); \
+            } else { \
+                lua_pop(L, 1); \
+            } \
+        }
+
+        FIELD_CHECK("add", ADD)
+        FIELD_CHECK("sub", SUB)
+        FIELD_CHECK("mul", MUL)
+        FIELD_CHECK("div", DIV)
+        FIELD_CHECK("mod", MOD)
+        FIELD_CHECK("pow", POW)
+        FIELD_CHECK("unm", UNM)
+        FIELD_CHECK("concat", CONCAT)
+        FIELD_CHECK("len", LEN)
+        FIELD_CHECK("eq", EQ)
+        FIELD_CHECK("lt", LT)
+        FIELD_CHECK("le", LE)
+        FIELD_CHECK("index", INDEX)
+        FIELD_CHECK("newindex", NEWINDEX)
+        FIELD_CHECK("call", CALL)
+        FIELD_CHECK("gc", GC)
+        FIELD_CHECK("tostring", TOSTRING)
+
+#if LUA_VERSION_NUM > 501
+        FIELD_CHECK("pairs", PAIRS)
+
+#if LUA_VERSION_NUM == 502
+        FIELD_CHECK("ipairs", IPAIRS)
+#endif
+
+#if LUA_VERSION_NUM > 502
+        FIELD_CHECK("idiv", IDIV)
+        FIELD_CHECK("band", BAND)
+        FIELD_CHECK("bor", BOR)
+        FIELD_CHECK("bxor", BXOR)
+        FIELD_CHECK("bnot", BNOT)
+        FIELD_CHECK("shl", SHL)
+        FIELD_CHECK("shr", SHR)
+#endif /* LUA_VERSION_NUM > 502 */
+#endif /* LUA_VERSION_NUM > 501 */
+
+#undef FIELD_CHECK
+
+        /* keep the metatable itself in the metatypes table */
+        lua::get_cdata_mt(L);
+        lua_getfield(L, -1, "__ffi_metatypes");
+        lua_pushvalue(L, 2);
+        mt.mt = luaL_ref(L, -2);
+        lua_pop(L, 2);
+        ast::decl_store::get_main(L).metatype(
+            ct.record(),
+            std::unique_ptr<ast::c_metatype>{new ast::c_metatype{mt}}
+        );
+
+        lua_pushvalue(L, 1);
+        return 1; /* return the ctype */
+    }
+
+    static int load_f(lua_State *L) {
+        char const *path = luaL_checkstring(L, 1);
+        bool glob = (lua_gettop(L) >= 2) && lua_toboolean(L, 2);
+        auto *c_ud = lua::newuserdata<lib::c_lib>(L);
+        lib::load(c_ud, path, L, glob);
+        return 1;
+    }
+
+    static int typeof_f(lua_State *L) {
+        check_ct(L, 1, (lua_gettop(L) > 1) ? 2 : -1);
+        return 1;
+    }
+
+    static int addressof_f(lua_State *L) {
+        auto &cd = ffi::checkcdata<void *>(L, 1);
+        if (cd.decl.type() == ast::C_BUILTIN_REF) {
+            /* refs/arrays are turned into pointers with the same addr */
+            ffi::newcdata<void *>(
+                L, cd.decl.as_type(ast::C_BUILTIN_PTR)
+            ).val = cd.val;
+        } else {
+            /* otherwise just make a cdata pointing to whatever it was */
+            ffi::newcdata<void *>(L, ast::c_type{cd.decl, 0}).val = &cd.val;
+        }
+        return 1;
+    }
+
+    static int gc_f(lua_State *L) {
+        auto &cd = ffi::checkcdata<ffi::noval>(L, 1);
+        if (lua_isnil(L, 2)) {
+            /* if nil and there is an existing finalizer, unset */
+            if (cd.gc_ref != LUA_REFNIL) {
+                luaL_unref(L, LUA_REGISTRYINDEX, cd.gc_ref);
+                cd.gc_ref = LUA_REFNIL;
+            }
+        } else {
+            /* new finalizer can be any type, it's pcall'd */
+            lua_pushvalue(L, 2);
+            stats::count(stats::REF_FINALIZER);
+            cd.gc_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+        lua_pushvalue(L, 1); /* return the cdata */
+        return 1;
+    }
+
+    static int adopt_gc(lua_State *L) {
+        finalize_transfer(static_cast<transfer_data *>(
+            lua_touserdata(L, lua_upvalueindex(1))
+        ));
+        return 0;
+    }
+
+    static int detach_f(lua_State *L) {
+        auto &cd = ffi::checkcdata<ffi::noval>(L, 1);
+        if (ffi::isctype(cd) || cd.decl.callable()) {
+            lua::type_error(L, 1, "data cdata");
+        }
+        bool ptr = (cd.decl.type() == ast::C_BUILTIN_PTR) ||
+            (cd.decl.type() == ast::C_BUILTIN_REF);
+        if (!ptr) {
+            /* moving it out of the userdata would mean a copy */
+            luaL_error(L, "cannot detach a value stored in a cdata");
+        }
+        if (cd.aux > 0) {
+            luaL_error(L, "cannot detach a view of a Lua value");
+        }
+        if (cd.aux == ffi::AUX_MAPPED) {
+            luaL_error(L, "cannot detach a shared memory mapping");
+        }
+        transfer_data *td = nullptr;
+        void (*fin)(void *) = nullptr;
+        if (cd.gc_ref != LUA_REFNIL) {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, cd.gc_ref);
+            if (lua_tocfunction(L, -1) == adopt_gc) {
+                /* adopted earlier, hand off the same payload */
+                lua_getupvalue(L, -1, 1);
+                td = static_cast<transfer_data *>(lua_touserdata(L, -1));
+                lua_pop(L, 1);
+            } else {
+                auto *fcd = ffi::testcdata<ffi::fdata>(L, -1);
+                if (
+                    !fcd || !fcd->decl.callable() || fcd->decl.closure() ||
+                    (fcd->decl.function().params().size() != 1)
+                ) {
+                    luaL_error(
+                        L, "finalizer must be a C function taking one argument"
+                    );
+                }
+                fin = reinterpret_cast<void (*)(void *)>(fcd->val.sym);
+            }
+            lua_pop(L, 1);
+        }
+        if (!td && (cd.decl.type() == ast::C_BUILTIN_REF)) {
+            /* references point into memory owned by someone else */
+            luaL_error(L, "cannot detach a reference");
+        }
+        if (!td && !fin) {
+            luaL_error(L, "cannot detach a pointer without a C finalizer");
+        }
+        if (!td) {
+            td = static_cast<transfer_data *>(malloc(sizeof(transfer_data)));
+            if (!td) {
+                luaL_error(L, "out of memory");
+            }
+            *td = transfer_data{ffi::tocdata<void *>(L, 1).val, fin};
+        }
+        /* the payload is no longer ours */
+        if (cd.gc_ref != LUA_REFNIL) {
+            luaL_unref(L, LUA_REGISTRYINDEX, cd.gc_ref);
+            cd.gc_ref = LUA_REFNIL;
+        }
+        ffi::tocdata<void *>(L, 1).val = nullptr;
+        handle_table::get().add_transfer(td);
+        lua_pushlightuserdata(L, td);
+        return 1;
+    }
+
+    static int adopt_f(lua_State *L) {
+        luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+        auto *td = static_cast<transfer_data *>(lua_touserdata(L, 1));
+        auto &ct = check_ct(L, 2);
+        auto &ht = handle_table::get();
+        if (!ht.has_transfer(td)) {
+            luaL_argerror(L, 1, "invalid or already adopted handle");
+        }
+        switch (ct.type()) {
+            case ast::C_BUILTIN_FUNC:
+            case ast::C_BUILTIN_REF:
+            case ast::C_BUILTIN_VOID:
+                luaL_argerror(L, 2, "invalid C type");
+                break;
+            case ast::C_BUILTIN_PTR:
+                if (ct.callable()) {
+                    luaL_argerror(L, 2, "invalid C type");
+                }
+                break;
+            default:
+                break;
+        }
+        /* everything that can fail is done before the handle is taken,
+         * so that a failed adopt leaves the payload with the table
+         */
+        lua_pushlightuserdata(L, td);
+        lua_pushcclosure(L, adopt_gc, 1);
+        if (ct.type() == ast::C_BUILTIN_PTR) {
+            ffi::newcdata<void *>(L, ct).val = td->data;
+        } else if (ct.type() == ast::C_BUILTIN_ARRAY) {
+            /* array references go through the array's own pointer */
+            auto &cd = ffi::newcdata<void *[2]>(
+                L, ast::c_type{ct, 0, ast::C_BUILTIN_REF}
+            );
+            cd.val[1] = td->data;
+            cd.val[0] = &cd.val[1];
+        } else {
+            /* values are referenced in place */
+            ffi::newcdata<void *>(
+                L, ast::c_type{ct, 0, ast::C_BUILTIN_REF}
+            ).val = td->data;
+        }
+        if (!ht.take_transfer(td)) {
+            /* adopted by someone else in the meantime */
+            luaL_argerror(L, 1, "invalid or already adopted handle");
+        }
+        auto &cd = ffi::tocdata<ffi::noval>(L, -1);
+        lua_insert(L, -2);
+        stats::count(stats::REF_FINALIZER);
+        cd.gc_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        return 1;
+    }
+
+    static int release_f(lua_State *L) {
+        luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+        void *h = lua_touserdata(L, 1);
+        auto &ht = handle_table::get();
+        if (ht.release_store(h)) {
+            return 0;
+        }
+        auto *td = static_cast<transfer_data *>(h);
+        if (!ht.take_transfer(td)) {
+            luaL_argerror(L, 1, "invalid handle");
+        }
+        finalize_transfer(td);
+        return 0;
+    }
+
+    static int shm_f(lua_State *L) {
+        char const *name = luaL_optstring(L, 1, nullptr);
+        auto &bct = check_ct(L, 2);
+        long long nelem = 0;
+        int oidx = 3;
+        if (bct.vla()) {
+            nelem = ffi::check_arith<long long>(L, 3);
+            luaL_argcheck(L, nelem >= 0, 3, "size of C type is unknown");
+            oidx = 4;
+        }
+        /* variable length arrays are mapped with the given length */
+        ast::c_type ct = bct.vla() ? ast::c_type{
+            bct.ptr_base(), bct.cv(), size_t(nelem), 0
+        } : bct;
+        bool invalid = false;
+        switch (ct.type()) {
+            case ast::C_BUILTIN_FUNC:
+            case ast::C_BUILTIN_REF:
+            case ast::C_BUILTIN_VOID:
+                invalid = true;
+                break;
+            case ast::C_BUILTIN_PTR:
+                invalid = ct.callable();
+                break;
+            case ast::C_BUILTIN_ARRAY:
+                invalid = ct.unbounded();
+                break;
+            case ast::C_BUILTIN_RECORD:
+                invalid = ct.record().opaque();
+                break;
+            default:
+                break;
+        }
+        luaL_argcheck(L, !invalid, 2, "invalid C type");
+        size_t sz = ct.alloc_size();
+        bool create = false;
+        if (!lua_isnoneornil(L, oidx)) {
+            luaL_checktype(L, oidx, LUA_TTABLE);
+            lua_getfield(L, oidx, "create");
+            create = lua_toboolean(L, -1);
+            lua_getfield(L, oidx, "size");
+            if (!lua_isnil(L, -1)) {
+                auto osz = ffi::check_arith<long long>(L, -1);
+                if (osz < 0 || size_t(osz) < sz) {
+                    luaL_error(
+                        L, "size too small for '%s'", ct.serialize().c_str()
+                    );
+                }
+                sz = size_t(osz);
+            }
+            lua_pop(L, 2);
+        }
+        if (!shm::supported()) {
+            luaL_error(L, "shared memory is not supported on this platform");
+        }
+        /* the view is made first, so that it owns the mapping right away */
+        void **slot;
+        int *aux;
+        if (ct.type() == ast::C_BUILTIN_PTR) {
+            auto &pcd = ffi::newcdata<void *>(L, ct, sizeof(ffi::mapping));
+            slot = &pcd.val;
+            aux = &pcd.aux;
+        } else if (ct.type() == ast::C_BUILTIN_ARRAY) {
+            auto &acd = ffi::newcdata<void *[2]>(
+                L, ast::c_type{std::move(ct), 0, ast::C_BUILTIN_REF},
+                sizeof(ffi::mapping)
+            );
+            acd.val[0] = &acd.val[1];
+            slot = &acd.val[1];
+            aux = &acd.aux;
+        } else {
+            auto &rcd = ffi::newcdata<void *>(
+                L, ast::c_type{std::move(ct), 0, ast::C_BUILTIN_REF},
+                sizeof(ffi::mapping)
+            );
+            slot = &rcd.val;
+            aux = &rcd.aux;
+        }
+        *slot = nullptr;
+        /* an anonymous segment is always new */
+        void *addr = shm::map(name, sz ? sz : 1, create || !name);
+        if (!addr) {
+            luaL_error(
+                L, "cannot map '%s': %s", name ? name : "anonymous",
+                strerror(errno)
+            );
+        }
+        /* the view references the segment in place */
+        *slot = addr;
+        auto *mp = reinterpret_cast<ffi::mapping *>(
+            static_cast<unsigned char *>(lua_touserdata(L, -1)) +
+            lua_rawlen(L, -1) - sizeof(ffi::mapping)
+        );
+        *mp = ffi::mapping{addr, sz ? sz : 1};
+        *aux = ffi::AUX_MAPPED;
+        ffi::mem_alloc(L, ffi::MEM_MAPPED, mp->size);
+        return 1;
+    }
+
+    static int shm_unlink_f(lua_State *L) {
+        char const *name = luaL_checkstring(L, 1);
+        if (!shm::unlink(name)) {
+            luaL_error(L, "cannot unlink '%s': %s", name, strerror(errno));
+        }
+        return 0;
+    }
+
+    static int sizeof_f(lua_State *L) {
+        if (ffi::iscdata(L, 1)) {
+            lua_pushinteger(L, ffi::cdata_value_size(L, 1));
+            return 1;
+        }
+        auto &ct = check_ct(L, 1);
+        if (ct.vla()) {
+            size_t sz = 0;
+            if (lua_isinteger(L, 2)) {
+                auto isz = lua_tointeger(L, 2);
+                if (isz < 0) {
                     return 0;
                 }
                 sz = size_t(isz);
@@ -1223,17 +3071,367 @@ struct ffi_module {
                 L, false, 1, "cannot convert 'ctype' to 'char const *'"
             );
         }
+        ffi::trace(L, ffi::TRACE_STR_COPY);
+        auto *str = static_cast<char const *>(ref_array_val(ud));
         if (lua_gettop(L) <= 1) {
-            lua_pushstring(L, static_cast<char const *>(ud.val));
+            lua_pushstring(L, str);
         } else {
-            lua_pushlstring(
-                L, static_cast<char const *>(ud.val),
-                ffi::check_arith<size_t>(L, 2)
+            lua_pushlstring(L, str, ffi::check_arith<size_t>(L, 2));
+        }
+        return 1;
+    }
+
+    static int view_f(lua_State *L) {
+        luaL_checktype(L, 1, LUA_TSTRING);
+        ast::c_type tp{ast::C_BUILTIN_CHAR, 0};
+        if (!lua_isnoneornil(L, 2)) {
+            auto &ct = check_ct(L, 2);
+            switch (ct.type()) {
+                case ast::C_BUILTIN_FUNC:
+                case ast::C_BUILTIN_REF:
+                    luaL_argcheck(L, false, 2, "invalid C type");
+                    break;
+                default:
+                    break;
+            }
+            using CT = ast::c_type;
+            tp.~CT();
+            new (&tp) CT{ct};
+        }
+        tp.cv(ast::C_CV_CONST);
+        auto &cd = ffi::newcdata<void const *>(
+            L, ast::c_type{std::move(tp), 0}
+        );
+        cd.val = lua_tostring(L, 1);
+        /* the view keeps the string alive */
+        lua_pushvalue(L, 1);
+        cd.aux = luaL_ref(L, LUA_REGISTRYINDEX);
+        return 1;
+    }
+
+    static int advance_f(lua_State *L) {
+        auto &cd = ffi::checkcdata<unsigned char *>(L, 1);
+        if (cd.decl.type() != ast::C_BUILTIN_PTR) {
+            lua::type_error(L, 1, "pointer");
+        }
+        size_t esz = cd.decl.ptr_base().alloc_size();
+        if (!esz) {
+            luaL_error(
+                L, "unknown element size of '%s'",
+                cd.decl.serialize().c_str()
+            );
+        }
+        auto n = luaL_checkinteger(L, 2);
+        cd.val += ptrdiff_t(esz) * ptrdiff_t(n);
+        lua_settop(L, 1);
+        return 1;
+    }
+
+    static int cursor_f(lua_State *L) {
+        if (lua_type(L, 1) == LUA_TSTRING) {
+            cursor_meta::make(
+                L, ast::c_type{ast::C_BUILTIN_CHAR, ast::C_CV_CONST},
+                const_cast<char *>(lua_tostring(L, 1)), lua_rawlen(L, 1), 1
+            );
+            return 1;
+        }
+        auto &cd = ffi::checkcdata<void *>(L, 1);
+        /* references to arrays are taken as the array, like in the
+         * buffer functions
+         */
+        bool ref = (cd.decl.type() == ast::C_BUILTIN_REF) &&
+            (cd.decl.ptr_base().type() == ast::C_BUILTIN_ARRAY);
+        auto &decl = ref ? cd.decl.ptr_base() : cd.decl;
+        if (
+            (decl.type() != ast::C_BUILTIN_PTR) &&
+            (decl.type() != ast::C_BUILTIN_ARRAY)
+        ) {
+            lua::type_error(L, 1, "pointer");
+        }
+        size_t len = SIZE_MAX;
+        if (!lua_isnoneornil(L, 2)) {
+            len = ffi::check_arith<size_t>(L, 2);
+        } else if (ref && !decl.unbounded()) {
+            len = decl.alloc_size();
+        } else if (
+            (decl.type() == ast::C_BUILTIN_ARRAY) && !decl.unbounded()
+        ) {
+            len = ffi::cdata_value_size(L, 1);
+        }
+        cursor_meta::make(L, decl.ptr_base(), ref_array_val(cd), len, 1);
+        return 1;
+    }
+
+    /* functions bound with out-parameters; the out slots receive pointers
+     * to storage taken for each call (the C stack for small slots, a fresh
+     * userdata otherwise, so that reentrant calls get their own) and the
+     * pointed-to values are returned after the result
+     */
+    static constexpr size_t BIND_STACK_SLOTS = 8;
+
+    struct bind_out {
+        int param;
+        ast::c_type const *type;
+        size_t offset;
+    };
+
+    struct bind_data {
+        size_t nout;
+        size_t dsz;
+
+        bind_out *outs() {
+            return reinterpret_cast<bind_out *>(this + 1);
+        }
+    };
+
+    static int bound_call(lua_State *L) {
+        auto &fd = ffi::tocdata<ffi::fdata>(L, lua_upvalueindex(1));
+        auto &bd = *lua::touserdata<bind_data>(L, lua_upvalueindex(2));
+        ffi::arg_stor_t sstor[BIND_STACK_SLOTS];
+        auto *sp = reinterpret_cast<unsigned char *>(sstor);
+        bool big = (bd.dsz > sizeof(sstor));
+        if (big) {
+            sp = static_cast<unsigned char *>(lua_newuserdata(L, bd.dsz));
+            lua_insert(L, 1);
+        }
+        memset(sp, 0, bd.dsz);
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_insert(L, 1);
+        /* parameters are offset by the function and any storage */
+        int base = big ? 2 : 1;
+        auto *outs = bd.outs();
+        for (size_t i = 0; i < bd.nout; ++i) {
+            int pidx = outs[i].param + base;
+            if (lua_gettop(L) < (pidx - 1)) {
+                lua_settop(L, pidx - 1);
+            }
+            lua_pushlightuserdata(L, sp + outs[i].offset);
+            lua_insert(L, pidx);
+        }
+        if (big) {
+            /* keep the storage alive above the arguments */
+            lua_pushvalue(L, 2);
+            lua_remove(L, 2);
+        }
+        int nres = ffi::call_cif(fd, L, size_t(lua_gettop(L) - base));
+        for (size_t i = 0; i < bd.nout; ++i) {
+            ffi::to_lua(L, *outs[i].type, sp + outs[i].offset, ffi::RULE_RET);
+        }
+        return nres + int(bd.nout);
+    }
+
+    static int bind_f(lua_State *L) {
+        auto &fd = ffi::checkcdata<ffi::fdata>(L, 1);
+        if (!fd.decl.callable()) {
+            lua::type_error(L, 1, "function");
+        }
+        luaL_checktype(L, 2, LUA_TTABLE);
+        auto &pars = fd.decl.function().params();
+        lua_getfield(L, 2, "out");
+        int oidx = lua_gettop(L);
+        size_t nout = 0;
+        if (!lua_isnil(L, oidx)) {
+            luaL_argcheck(
+                L, lua_istable(L, oidx), 2, "'out' must be a table"
+            );
+            nout = lua_rawlen(L, oidx);
+        }
+        /* per-call storage needed by the out slots */
+        size_t dsz = 0;
+        for (size_t i = 1; i <= nout; ++i) {
+            lua_rawgeti(L, oidx, int(i));
+            auto pidx = lua_tointeger(L, -1);
+            lua_pop(L, 1);
+            if ((pidx < 1) || (size_t(pidx) > pars.size())) {
+                luaL_error(L, "invalid out-parameter %d", int(pidx));
+            }
+            auto &ptp = pars[pidx - 1].type();
+            if (
+                (ptp.type() != ast::C_BUILTIN_PTR) ||
+                !ptp.ptr_base().alloc_size() ||
+                (ptp.ptr_base().type() == ast::C_BUILTIN_FUNC)
+            ) {
+                luaL_error(
+                    L, "out-parameter %d is not a pointer to a complete type",
+                    int(pidx)
+                );
+            }
+            size_t asz = ptp.ptr_base().alloc_size();
+            /* keep each slot aligned like any argument storage */
+            dsz += (asz + sizeof(ffi::arg_stor_t) - 1) /
+                sizeof(ffi::arg_stor_t) * sizeof(ffi::arg_stor_t);
+        }
+        size_t hsz = sizeof(bind_data) + nout * sizeof(bind_out);
+        lua_pushvalue(L, 1);
+        auto *bd = static_cast<bind_data *>(lua_newuserdata(L, hsz));
+        bd->nout = nout;
+        bd->dsz = dsz;
+        auto *outs = bd->outs();
+        size_t off = 0;
+        for (size_t i = 0; i < nout; ++i) {
+            lua_rawgeti(L, oidx, int(i + 1));
+            outs[i].param = int(lua_tointeger(L, -1));
+            lua_pop(L, 1);
+            for (size_t j = 0; j < i; ++j) {
+                if (outs[j].param == outs[i].param) {
+                    luaL_error(
+                        L, "duplicate out-parameter %d", outs[i].param
+                    );
+                }
+            }
+            outs[i].type = &pars[outs[i].param - 1].type().ptr_base();
+            outs[i].offset = off;
+            size_t asz = outs[i].type->alloc_size();
+            off += (asz + sizeof(ffi::arg_stor_t) - 1) /
+                sizeof(ffi::arg_stor_t) * sizeof(ffi::arg_stor_t);
+        }
+        /* parameters are inserted in ascending order */
+        std::sort(outs, outs + nout, [](auto const &a, auto const &b) {
+            return a.param < b.param;
+        });
+        lua_pushcclosure(L, bound_call, 2);
+        return 1;
+    }
+
+    /* parallel loops over C kernels; the arguments are converted once on
+     * the calling thread, then the chunks are called with the function's
+     * cif from the workers, which never touch the Lua state
+     */
+    static constexpr size_t PFOR_MAX_ARGS = 16;
+
+    struct pfor_data {
+        ffi::cdata<ffi::fdata> *fd;
+        ast::c_type const *btp;
+        ast::c_type const *etp;
+        void **xvals;
+        size_t nextra;
+    };
+
+    static void pfor_store_idx(
+        ast::c_type const &tp, ffi::arg_stor_t &stor, size_t v
+    ) {
+        switch (tp.alloc_size()) {
+            case 1: stor.as<uint8_t>() = uint8_t(v); break;
+            case 2: stor.as<uint16_t>() = uint16_t(v); break;
+            case 4: stor.as<uint32_t>() = uint32_t(v); break;
+            default: stor.as<uint64_t>() = uint64_t(v); break;
+        }
+    }
+
+    /* the largest bound a kernel's index parameter can take */
+    static unsigned long long pfor_max_idx(ast::c_type const &tp) {
+        if (tp.type() == ast::C_BUILTIN_BOOL) {
+            return 1;
+        }
+        size_t bits = tp.alloc_size() * 8;
+        if (!tp.is_unsigned()) {
+            --bits;
+        }
+        return (bits >= 64) ? ~0ULL : ((1ULL << bits) - 1);
+    }
+
+    static void pfor_chunk(size_t b, size_t e, void *data) {
+        auto &pd = *static_cast<pfor_data *>(data);
+        ffi::arg_stor_t bst, est, rst;
+        void *vals[PFOR_MAX_ARGS];
+        pfor_store_idx(*pd.btp, bst, b);
+        pfor_store_idx(*pd.etp, est, e);
+        vals[0] = &bst;
+        vals[1] = &est;
+        for (size_t i = 0; i < pd.nextra; ++i) {
+            vals[i + 2] = pd.xvals[i];
+        }
+        ffi_call(&pd.fd->val.cif, pd.fd->val.sym, &rst, vals);
+    }
+
+    static int parallel_for_f(lua_State *L) {
+        auto &fd = ffi::checkcdata<ffi::fdata>(L, 1);
+        if (!fd.decl.callable()) {
+            lua::type_error(L, 1, "function");
+        }
+        luaL_argcheck(
+            L, !fd.decl.closure(), 1, "callbacks cannot run in parallel"
+        );
+        auto &func = fd.decl.function();
+        auto &pars = func.params();
+        luaL_argcheck(
+            L, !func.variadic() && (pars.size() >= 2) &&
+            (pars.size() <= PFOR_MAX_ARGS) &&
+            pars[0].type().integer() && pars[1].type().integer() &&
+            (pars[0].type().alloc_size() <= sizeof(uint64_t)) &&
+            (pars[1].type().alloc_size() <= sizeof(uint64_t)) &&
+            (func.result().alloc_size() <= sizeof(ffi::arg_stor_t)),
+            1, "invalid kernel signature"
+        );
+        auto n = ffi::check_arith<long long>(L, 2);
+        using U = unsigned long long;
+        luaL_argcheck(
+            L, (n >= 0) && (U(n) <= pfor_max_idx(pars[0].type())) &&
+            (U(n) <= pfor_max_idx(pars[1].type())), 2, "invalid range"
+        );
+        size_t nextra = pars.size() - 2;
+        size_t nlargs = size_t(lua_gettop(L) - 2);
+        long long grain = 0;
+        int aidx = 3;
+        if (nlargs == (nextra + 1)) {
+            grain = ffi::check_arith<long long>(L, 3);
+            luaL_argcheck(L, grain > 0, 3, "invalid grain");
+            aidx = 4;
+        } else if (nlargs != nextra) {
+            luaL_error(
+                L, "wrong number of arguments (expected %d)", int(nextra)
+            );
+        }
+        /* the converted arguments are shared by all chunks */
+        auto *stor = static_cast<ffi::arg_stor_t *>(lua_newuserdata(
+            L, nextra * (sizeof(ffi::arg_stor_t) + sizeof(void *)) + 1
+        ));
+        auto **xvals = reinterpret_cast<void **>(&stor[nextra]);
+        for (size_t i = 0; i < nextra; ++i) {
+            size_t asz;
+            xvals[i] = ffi::from_lua(
+                L, pars[i + 2].type(), &stor[i], aidx + int(i), asz,
+                ffi::RULE_PASS
             );
         }
+        pfor_data pd{&fd, &pars[0].type(), &pars[1].type(), xvals, nextra};
+        pool::parallel_for(size_t(n), size_t(grain), pfor_chunk, &pd);
+        return 0;
+    }
+
+    static int threads_f(lua_State *L) {
+        if (!lua_isnoneornil(L, 1)) {
+            auto n = luaL_checkinteger(L, 1);
+            luaL_argcheck(L, n >= 0, 1, "invalid thread count");
+            if (!pool::set_threads(size_t(n))) {
+                luaL_error(L, "the thread pool is already running");
+            }
+        }
+        lua_pushinteger(L, lua_Integer(pool::threads()));
+        return 1;
+    }
+
+    static int soa_f(lua_State *L) {
+        auto &ct = check_ct(L, 1);
+        auto n = luaL_checkinteger(L, 2);
+        luaL_argcheck(L, n >= 0, 2, "invalid number of elements");
+        soa_meta::make(L, ct, size_t(n));
         return 1;
     }
 
+    /* references to arrays (such as array members of records) point to
+     * where the address of the array is stored
+     */
+    static void *ref_array_val(ffi::cdata<void *> &cd) {
+        if (
+            (cd.decl.type() == ast::C_BUILTIN_REF) &&
+            (cd.decl.ptr_base().type() == ast::C_BUILTIN_ARRAY)
+        ) {
+            return *static_cast<void **>(cd.val);
+        }
+        return cd.val;
+    }
+
     /* FIXME: type conversions (constness etc.) */
     static void *check_voidptr(lua_State *L, int idx) {
         if (ffi::iscval(L, idx)) {
@@ -1255,7 +3453,7 @@ struct ffi_module {
                 );
                 luaL_argcheck(L, false, idx, lua_tostring(L, -1));
             }
-            return cd.val;
+            return ref_array_val(cd);
         } else if (lua_isuserdata(L, idx)) {
             return lua_touserdata(L, idx);
         }
@@ -1296,6 +3494,135 @@ struct ffi_module {
         return 0;
     }
 
+    /* like check_voidptr, but Lua strings are accepted too as long as
+     * they have at least len bytes
+     */
+    static void const *check_srcptr(lua_State *L, int idx, size_t len) {
+        if (lua_type(L, idx) == LUA_TSTRING) {
+            luaL_argcheck(
+                L, lua_rawlen(L, idx) >= len, idx, "string too short"
+            );
+            return lua_tostring(L, idx);
+        }
+        return check_voidptr(L, idx);
+    }
+
+    static int move_f(lua_State *L) {
+        void *dst = check_voidptr(L, 1);
+        size_t len = ffi::check_arith<size_t>(L, 3);
+        memmove(dst, check_srcptr(L, 2, len), len);
+        return 0;
+    }
+
+    static int compare_f(lua_State *L) {
+        size_t len = ffi::check_arith<size_t>(L, 3);
+        int r = memcmp(check_srcptr(L, 1, len), check_srcptr(L, 2, len), len);
+        lua_pushinteger(L, (r > 0) - (r < 0));
+        return 1;
+    }
+
+    /* the libc functions used here are vectorized where it matters, so
+     * these scan whole buffers without going through Lua for each byte
+     */
+    static int find_f(lua_State *L) {
+        auto *buf = static_cast<unsigned char const *>(check_voidptr(L, 1));
+        size_t len = ffi::check_arith<size_t>(L, 2);
+        size_t init = 0;
+        if (!lua_isnoneornil(L, 4)) {
+            init = ffi::check_arith<size_t>(L, 4);
+        }
+        unsigned char byte;
+        unsigned char const *ndl = &byte;
+        size_t nlen = 1;
+        if (lua_type(L, 3) == LUA_TSTRING) {
+            ndl = reinterpret_cast<unsigned char const *>(
+                lua_tolstring(L, 3, &nlen)
+            );
+        } else {
+            byte = static_cast<unsigned char>(ffi::check_arith<int>(L, 3));
+        }
+        if ((init > len) || (nlen > (len - init))) {
+            lua_pushnil(L);
+            return 1;
+        }
+        if (!nlen) {
+            lua_pushinteger(L, lua_Integer(init));
+            return 1;
+        }
+        /* the last position the needle can start at */
+        auto *p = buf + init, *e = buf + len - nlen + 1;
+        while (p < e) {
+            p = static_cast<unsigned char const *>(
+                memchr(p, ndl[0], size_t(e - p))
+            );
+            if (!p) {
+                break;
+            }
+            if (!memcmp(p + 1, ndl + 1, nlen - 1)) {
+                lua_pushinteger(L, lua_Integer(p - buf));
+                return 1;
+            }
+            ++p;
+        }
+        lua_pushnil(L);
+        return 1;
+    }
+
+    static int count_f(lua_State *L) {
+        auto *p = static_cast<unsigned char const *>(check_voidptr(L, 1));
+        size_t len = ffi::check_arith<size_t>(L, 2);
+        int byte = ffi::check_arith<int>(L, 3);
+        auto *e = p + len;
+        size_t n = 0;
+        while ((p = static_cast<unsigned char const *>(
+            memchr(p, byte, size_t(e - p))
+        ))) {
+            ++n;
+            if (++p == e) {
+                break;
+            }
+        }
+        lua_pushinteger(L, lua_Integer(n));
+        return 1;
+    }
+
+    /* strides are in bytes and may be negative */
+    static int copy_strided_f(lua_State *L) {
+        auto *dst = static_cast<unsigned char *>(check_voidptr(L, 1));
+        auto dstr = ffi::check_arith<ptrdiff_t>(L, 2);
+        auto *src = static_cast<unsigned char const *>(check_voidptr(L, 3));
+        auto sstr = ffi::check_arith<ptrdiff_t>(L, 4);
+        size_t n = ffi::check_arith<size_t>(L, 5);
+        size_t esz = ffi::check_arith<size_t>(L, 6);
+        if ((dstr == ptrdiff_t(esz)) && (sstr == ptrdiff_t(esz))) {
+            memmove(dst, src, n * esz);
+            return 0;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            memmove(dst, src, esz);
+            dst += dstr;
+            src += sstr;
+        }
+        return 0;
+    }
+
+    static int fill_strided_f(lua_State *L) {
+        auto *dst = static_cast<unsigned char *>(check_voidptr(L, 1));
+        auto dstr = ffi::check_arith<ptrdiff_t>(L, 2);
+        size_t n = ffi::check_arith<size_t>(L, 3);
+        size_t esz = ffi::check_arith<size_t>(L, 4);
+        int byte = int(luaL_optinteger(L, 5, 0));
+        if (dstr == ptrdiff_t(esz)) {
+            memset(dst, byte, n * esz);
+            return 0;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            memset(dst, byte, esz);
+            dst += dstr;
+        }
+        return 0;
+    }
+
     static int tonumber_f(lua_State *L) {
         auto *cd = ffi::testcdata<void *>(L, 1);
         if (cd) {
@@ -1347,6 +3674,89 @@ struct ffi_module {
         return 1;
     }
 
+    /* in-place arithmetic on integer cdata; the operation is done in
+     * 64 bits and the result truncated to the type of the target, which
+     * gives wrap-around semantics for every integer width
+     */
+    template<ast::c_expr_binop op>
+    static int iarith_f(lua_State *L) {
+        auto &cd = ffi::checkcdata<void *>(L, 1);
+        auto const *tp = &cd.decl;
+        void *addr = &cd.val;
+        if (tp->type() == ast::C_BUILTIN_REF) {
+            tp = &tp->ptr_base();
+            addr = cd.val;
+        }
+        if (
+            !tp->integer() || (tp->type() == ast::C_BUILTIN_BOOL) ||
+            (tp->cv() & ast::C_CV_CONST)
+        ) {
+            lua::type_error(L, 1, "integer cdata");
+        }
+        ast::c_value rv;
+        auto rt = ffi::check_arith_expr(L, 2, rv);
+        cdata_meta::promote_long(rt);
+        if (rt != ast::c_expr_type::ULLONG) {
+            cdata_meta::promote_to_64bit<
+                long long, ast::c_expr_type::LLONG
+            >(rt, &rv);
+        }
+        bool uns = tp->is_unsigned();
+        size_t sz = tp->alloc_size();
+        /* the current value, sign or zero extended */
+        uint64_t v = 0;
+        switch (sz) {
+#define IARITH_LOAD(sz, S, U) case sz: { \
+                U uv; \
+                memcpy(&uv, addr, sz); \
+                v = uns ? uint64_t(uv) : uint64_t(int64_t(S(uv))); \
+                break; \
+            }
+            IARITH_LOAD(1, int8_t, uint8_t)
+            IARITH_LOAD(2, int16_t, uint16_t)
+            IARITH_LOAD(4, int32_t, uint32_t)
+            IARITH_LOAD(8, int64_t, uint64_t)
+#undef IARITH_LOAD
+            default:
+                lua::type_error(L, 1, "integer cdata");
+                break;
+        }
+        uint64_t y = rv.ull;
+        switch (op) {
+            case ast::c_expr_binop::ADD: v += y; break;
+            case ast::c_expr_binop::SUB: v -= y; break;
+            case ast::c_expr_binop::MUL: v *= y; break;
+            case ast::c_expr_binop::BAND: v &= y; break;
+            case ast::c_expr_binop::BOR: v |= y; break;
+            case ast::c_expr_binop::BXOR: v ^= y; break;
+            case ast::c_expr_binop::LSH:
+            case ast::c_expr_binop::RSH:
+                /* the value is zero or sign extended, so 64-bit shifts
+                 * bring in the same bits as shifting the stored type
+                 */
+                if (uns) {
+                    v = cdata_meta::shift_64bit_op(op, v, rt, rv);
+                } else {
+                    v = uint64_t(cdata_meta::shift_64bit_op(
+                        op, int64_t(v), rt, rv
+                    ));
+                }
+                break;
+            default:
+                assert(false);
+                break;
+        }
+        /* store back truncated */
+        switch (sz) {
+            case 1: { auto tv = uint8_t(v); memcpy(addr, &tv, 1); break; }
+            case 2: { auto tv = uint16_t(v); memcpy(addr, &tv, 2); break; }
+            case 4: { auto tv = uint32_t(v); memcpy(addr, &tv, 4); break; }
+            default: memcpy(addr, &v, 8); break;
+        }
+        lua_settop(L, 1);
+        return 1;
+    }
+
     static int type_f(lua_State *L) {
         if (ffi::iscval(L, 1)) {
             lua_pushliteral(L, "cdata");
@@ -1357,6 +3767,101 @@ struct ffi_module {
         return 1;
     }
 
+    static int memstats_f(lua_State *L) {
+        auto &ms = ffi::mem_stats::get_main(L);
+        lua_createtable(L, 0, 7);
+        lua_pushinteger(L, lua_Integer(ms.ncdata));
+        lua_setfield(L, -2, "count");
+        lua_pushinteger(L, lua_Integer(ms.cdata_bytes));
+        lua_setfield(L, -2, "cdata");
+        lua_pushinteger(L, lua_Integer(ms.bytes[ffi::MEM_CTYPE]));
+        lua_setfield(L, -2, "ctype");
+        lua_pushinteger(L, lua_Integer(ms.bytes[ffi::MEM_CLOSURE]));
+        lua_setfield(L, -2, "closure");
+        lua_pushinteger(L, lua_Integer(ms.bytes[ffi::MEM_MAPPED]));
+        lua_setfield(L, -2, "mapped");
+        size_t ext = 0;
+        for (size_t b: ms.bytes) {
+            ext += b;
+        }
+        lua_pushinteger(L, lua_Integer(ext));
+        lua_setfield(L, -2, "external");
+        return 1;
+    }
+
+    static int declstats_f(lua_State *L) {
+        auto &ds = ast::decl_store::get_main(L);
+        ast::decl_stats st;
+        ds.stats(st);
+        lua_createtable(L, 0, 12);
+        lua_pushinteger(L, lua_Integer(st.records));
+        lua_setfield(L, -2, "records");
+        lua_pushinteger(L, lua_Integer(st.functions));
+        lua_setfield(L, -2, "functions");
+        lua_pushinteger(L, lua_Integer(st.variables));
+        lua_setfield(L, -2, "variables");
+        lua_pushinteger(L, lua_Integer(st.typedefs));
+        lua_setfield(L, -2, "typedefs");
+        lua_pushinteger(L, lua_Integer(st.constants));
+        lua_setfield(L, -2, "constants");
+        lua_pushinteger(L, lua_Integer(st.enums));
+        lua_setfield(L, -2, "enums");
+        lua_pushinteger(L, lua_Integer(st.enum_fields));
+        lua_setfield(L, -2, "enum_fields");
+        lua_pushinteger(L, lua_Integer(st.ast_bytes));
+        lua_setfield(L, -2, "ast_bytes");
+        lua_pushinteger(L, lua_Integer(st.ffi_bytes));
+        lua_setfield(L, -2, "ffi_bytes");
+        lua_pushinteger(L, lua_Integer(st.name_bytes));
+        lua_setfield(L, -2, "name_bytes");
+        lua_pushnumber(L, lua_Number(ds.parse_time()) / 1e9);
+        lua_setfield(L, -2, "parse_time");
+        auto &ps = ds.parses();
+        lua_createtable(L, int(ps.size()), 0);
+        for (size_t i = 0; i < ps.size(); ++i) {
+            lua_createtable(L, 0, 3);
+            lua_pushnumber(L, lua_Number(ps[i].ns) / 1e9);
+            lua_setfield(L, -2, "time");
+            lua_pushinteger(L, lua_Integer(ps[i].ndecls));
+            lua_setfield(L, -2, "decls");
+            lua_pushinteger(L, lua_Integer(ps[i].nchars));
+            lua_setfield(L, -2, "size");
+            lua_rawseti(L, -2, int(i + 1));
+        }
+        lua_setfield(L, -2, "cdefs");
+        return 1;
+    }
+
+    static int stats_f(lua_State *L) {
+#ifdef HAVE_STATS
+        static char const *const names[] = {
+            "cdata_scalar", "cdata_pointer", "cdata_record", "cdata_array",
+            "cdata_func", "cdata_callback", "bytes", "type_copies",
+            "prep_cif", "prep_cif_var", "ref_finalizer", "ref_callback",
+            "slow_to_lua", "slow_from_lua"
+        };
+        static_assert(
+            (sizeof(names) / sizeof(names[0])) == stats::COUNTER_MAX,
+            "counter names out of sync"
+        );
+        lua_createtable(L, 0, stats::COUNTER_MAX);
+        for (int i = 0; i < stats::COUNTER_MAX; ++i) {
+            lua_pushinteger(L, lua_Integer(stats::counters[i]));
+            lua_setfield(L, -2, names[i]);
+        }
+        if (lua_toboolean(L, 1)) {
+            for (auto &c: stats::counters) {
+                c = 0;
+            }
+        }
+        return 1;
+#else
+        /* not compiled in */
+        lua_pushnil(L);
+        return 1;
+#endif
+    }
+
     static int abi_f(lua_State *L) {
         luaL_checkstring(L, 1);
         lua_pushvalue(L, 1);
@@ -1418,6 +3923,8 @@ struct ffi_module {
         static luaL_Reg const lib_def[] = {
             /* core */
             {"cdef", cdef_f},
+            {"freeze", freeze_f},
+            {"attach", attach_f},
             {"load", load_f},
 
             /* data handling */
@@ -1427,6 +3934,17 @@ struct ffi_module {
             {"typeof", typeof_f},
             {"addressof", addressof_f},
             {"gc", gc_f},
+            {"detach", detach_f},
+            {"adopt", adopt_f},
+            {"release", release_f},
+            {"shm", shm_f},
+            {"shm_unlink", shm_unlink_f},
+            {"soa", soa_f},
+            {"advance", advance_f},
+            {"cursor", cursor_f},
+            {"bind", bind_f},
+            {"parallel_for", parallel_for_f},
+            {"threads", threads_f},
 
             /* type info */
             {"sizeof", sizeof_f},
@@ -1437,11 +3955,31 @@ struct ffi_module {
             /* utilities */
             {"errno", errno_f},
             {"string", string_f},
+            {"view", view_f},
             {"copy", copy_f},
             {"fill", fill_f},
+            {"move", move_f},
+            {"compare", compare_f},
+            {"find", find_f},
+            {"count", count_f},
+            {"copy_strided", copy_strided_f},
+            {"fill_strided", fill_strided_f},
+            {"pack", pack_ops::pack_f},
+            {"unpack", pack_ops::unpack_f},
             {"toretval", toretval_f},
+            {"iadd", iarith_f<ast::c_expr_binop::ADD>},
+            {"isub", iarith_f<ast::c_expr_binop::SUB>},
+            {"imul", iarith_f<ast::c_expr_binop::MUL>},
+            {"iband", iarith_f<ast::c_expr_binop::BAND>},
+            {"ibor", iarith_f<ast::c_expr_binop::BOR>},
+            {"ibxor", iarith_f<ast::c_expr_binop::BXOR>},
+            {"ishl", iarith_f<ast::c_expr_binop::LSH>},
+            {"ishr", iarith_f<ast::c_expr_binop::RSH>},
             {"eval", eval_f},
             {"type", type_f},
+            {"memstats", memstats_f},
+            {"declstats", declstats_f},
+            {"stats", stats_f},
 
             {NULL, NULL}
         };
@@ -1467,6 +4005,18 @@ struct ffi_module {
             ast::c_type{ast::C_BUILTIN_VOID, 0}, 0
         }).val = nullptr;
         lua_setfield(L, -2, "nullptr");
+
+        /* atomic operations */
+        atomic_ops::setup(L);
+        lua_setfield(L, -2, "atomic");
+
+        /* call profiler */
+        profile_ops::setup(L);
+        lua_setfield(L, -2, "profile");
+
+        /* conversion tracer */
+        trace_ops::setup(L);
+        lua_setfield(L, -2, "trace");
     }
 
     static void setup_dstor(lua_State *L) {
@@ -1491,12 +4041,72 @@ struct ffi_module {
         /* stack: empty */
     }
 
+    static void setup_mstats(lua_State *L) {
+        /* memory accounting is plain data, so no finalizer is needed */
+        auto *ud = lua::newuserdata<ffi::mem_stats>(L);
+        new (ud) ffi::mem_stats{};
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &lua::CFFI_MEM_STATS_KEY);
+    }
+
+    static void setup_scratch(lua_State *L) {
+        /* a pool of argument blocks for calls that don't fit on the stack */
+        lua_newtable(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, lua::CFFI_CALL_SCRATCH);
+    }
+
+    static void setup_profile(lua_State *L) {
+        auto *ud = lua::newuserdata<ffi::profile_data>(L);
+        new (ud) ffi::profile_data{};
+        lua_newtable(L);
+        lua_pushcfunction(L, [](lua_State *LL) -> int {
+            using T = ffi::profile_data;
+            auto *pd = lua::touserdata<T>(LL, 1);
+            /* a running profile counts for all states */
+            pd->stop();
+            pd->~T();
+            return 0;
+        });
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, lua::CFFI_PROFILE);
+    }
+
+    static void setup_trace(lua_State *L) {
+        auto *ud = lua::newuserdata<ffi::trace_data>(L);
+        new (ud) ffi::trace_data{};
+        lua_newtable(L);
+        lua_pushcfunction(L, [](lua_State *LL) -> int {
+            using T = ffi::trace_data;
+            auto *td = lua::touserdata<T>(LL, 1);
+            td->stop();
+            td->~T();
+            return 0;
+        });
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, LUA_REGISTRYINDEX, lua::CFFI_TRACE);
+    }
+
     static void open(lua_State *L) {
         setup_dstor(L); /* declaration store */
+        setup_mstats(L); /* memory accounting */
+        setup_scratch(L); /* call argument storage */
+        setup_profile(L); /* call profiler */
+        setup_trace(L); /* conversion tracer */
+
+        /* compiled record layouts for pack and unpack */
+        lua_newtable(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, lua::CFFI_PACK_PLANS);
 
         /* cdata handles */
         cdata_meta::setup(L);
 
+        /* struct-of-arrays containers */
+        soa_meta::setup(L);
+
+        /* buffer cursors */
+        cursor_meta::setup(L);
+
         setup(L); /* push table to stack */
 
         /* lib handles, needs the module table on the stack */
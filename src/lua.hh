@@ -72,6 +72,25 @@ static inline size_t lua_rawlen52(lua_State *L, int index) {
 #endif
 #define lua_rawlen lua_rawlen52
 
+/* 5.1 has no user values, but environment tables serve the same purpose */
+static inline void lua_setuservalue52(lua_State *L, int idx) {
+    lua_setfenv(L, idx);
+}
+
+static inline void lua_getuservalue52(lua_State *L, int idx) {
+    lua_getfenv(L, idx);
+}
+
+#ifdef lua_setuservalue
+#undef lua_setuservalue
+#endif
+#define lua_setuservalue lua_setuservalue52
+
+#ifdef lua_getuservalue
+#undef lua_getuservalue
+#endif
+#define lua_getuservalue lua_getuservalue52
+
 static inline void luaL_newlib52(lua_State *L, luaL_Reg const l[]) {
     lua_newtable(L);
     luaL_register(L, nullptr, l);
@@ -82,6 +101,45 @@ static inline void luaL_newlib52(lua_State *L, luaL_Reg const l[]) {
 #endif
 #define luaL_newlib luaL_newlib52
 
+static inline void lua_rawgetp52(lua_State *L, int idx, void const *p) {
+    if ((idx < 0) && (idx > LUA_REGISTRYINDEX)) {
+        idx = lua_gettop(L) + idx + 1;
+    }
+    lua_pushlightuserdata(L, const_cast<void *>(p));
+    lua_rawget(L, idx);
+}
+
+static inline void lua_rawsetp52(lua_State *L, int idx, void const *p) {
+    if ((idx < 0) && (idx > LUA_REGISTRYINDEX)) {
+        idx = lua_gettop(L) + idx + 1;
+    }
+    lua_pushlightuserdata(L, const_cast<void *>(p));
+    lua_insert(L, -2);
+    lua_rawset(L, idx);
+}
+
+#ifdef lua_rawgetp
+#undef lua_rawgetp
+#endif
+#define lua_rawgetp lua_rawgetp52
+
+#ifdef lua_rawsetp
+#undef lua_rawsetp
+#endif
+#define lua_rawsetp lua_rawsetp52
+
+static inline int lua_absindex52(lua_State *L, int idx) {
+    if ((idx < 0) && (idx > LUA_REGISTRYINDEX)) {
+        return lua_gettop(L) + idx + 1;
+    }
+    return idx;
+}
+
+#ifdef lua_absindex
+#undef lua_absindex
+#endif
+#define lua_absindex lua_absindex52
+
 #endif /* LUA_VERSION_NUM == 501 */
 
 #if LUA_VERSION_NUM < 503
@@ -98,7 +156,25 @@ namespace lua {
 static constexpr int CFFI_CTYPE_TAG = -128;
 static constexpr char const CFFI_CDATA_MT[] = "cffi_cdata_handle";
 static constexpr char const CFFI_LIB_MT[] = "cffi_lib_handle";
+static constexpr char const CFFI_SOA_MT[] = "cffi_soa_handle";
+static constexpr char const CFFI_SOA_ROW_MT[] = "cffi_soa_row_handle";
+static constexpr char const CFFI_CURSOR_MT[] = "cffi_cursor_handle";
 static constexpr char const CFFI_DECL_STOR[] = "cffi_decl_stor";
+static constexpr char const CFFI_CALL_SCRATCH[] = "cffi_call_scratch";
+static constexpr char const CFFI_PROFILE[] = "cffi_profile";
+static constexpr char const CFFI_TRACE[] = "cffi_trace";
+static constexpr char const CFFI_PACK_PLANS[] = "cffi_pack_plans";
+
+/* all cdata metatables have a field under the address of this, which
+ * is what type checks look for; the common one is also stored in the
+ * registry under it, so that it doesn't have to be looked up by name
+ */
+extern char const CFFI_CDATA_MT_KEY;
+
+/* the memory accounting of the state is stored in the registry under the
+ * address of this, as it is looked up for every cdata
+ */
+extern char const CFFI_MEM_STATS_KEY;
 
 template<typename T>
 static T *newuserdata(lua_State *L, size_t extra = 0) {
@@ -118,8 +194,27 @@ static inline int type_error(lua_State *L, int narg, char const *tname) {
     return 0;
 }
 
+static inline void get_cdata_mt(lua_State *L) {
+    lua_rawgetp(L, LUA_REGISTRYINDEX, &CFFI_CDATA_MT_KEY);
+}
+
 static inline void mark_cdata(lua_State *L) {
-    luaL_setmetatable(L, CFFI_CDATA_MT);
+    get_cdata_mt(L);
+    lua_setmetatable(L, -2);
+}
+
+/* like luaL_testudata for any of the cdata metatables */
+static inline void *testcval(lua_State *L, int idx) {
+    void *p = lua_touserdata(L, idx);
+    if (!p || !lua_getmetatable(L, idx)) {
+        return nullptr;
+    }
+    lua_rawgetp(L, -1, &CFFI_CDATA_MT_KEY);
+    if (!lua_toboolean(L, -1)) {
+        p = nullptr;
+    }
+    lua_pop(L, 2);
+    return p;
 }
 
 static inline void mark_lib(lua_State *L) {
@@ -249,7 +249,7 @@ struct lex_state {
 
     ast::c_type param_get_type() {
         ensure_pidx();
-        if (!luaL_testudata(p_L, p_pidx, lua::CFFI_CDATA_MT)) {
+        if (!lua::testcval(p_L, p_pidx)) {
             syntax_error("type expected");
         }
         auto ct = *lua::touserdata<ast::c_type>(p_L, p_pidx);
@@ -1693,7 +1693,8 @@ static ast::c_record const &parse_record(lex_state &ls, bool *newst) {
     auto *oldecl = ls.lookup(sname.c_str());
     if (oldecl && (oldecl->obj_type() == ast::c_object_type::RECORD)) {
         auto &st = oldecl->as<ast::c_record>();
-        if (st.opaque()) {
+        /* shared declarations are immutable, redefinition errors out */
+        if (st.opaque() && !st.frozen()) {
             /* previous declaration was opaque; prevent redef errors */
             st.set_fields(std::move(fields));
             if (newst) {
@@ -1790,7 +1791,7 @@ static ast::c_enum const &parse_enum(lex_state &ls) {
     auto *oldecl = ls.lookup(ename.c_str());
     if (oldecl && (oldecl->obj_type() == ast::c_object_type::ENUM)) {
         auto &st = oldecl->as<ast::c_enum>();
-        if (st.opaque()) {
+        if (st.opaque() && !st.frozen()) {
             /* previous declaration was opaque; prevent redef errors */
             st.set_fields(std::move(fields));
             return st;
@@ -0,0 +1,253 @@
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <limits>
+#include <system_error>
+
+#include "pool.hh"
+
+namespace pool {
+
+/* a part of the chunk index space initially given to one participant
+ *
+ * the owner takes chunks from the front and thieves take them from the
+ * back; both ends are packed together so that a single compare-exchange
+ * is enough to claim a chunk either way
+ */
+struct slice {
+    std::atomic<uint64_t> range{0};
+
+    static uint64_t pack(uint32_t front, uint32_t back) {
+        return (uint64_t(front) << 32) | back;
+    }
+
+    bool pop_front(uint32_t &idx) {
+        auto r = range.load(std::memory_order_relaxed);
+        for (;;) {
+            auto front = uint32_t(r >> 32), back = uint32_t(r);
+            if (front >= back) {
+                return false;
+            }
+            if (range.compare_exchange_weak(
+                r, pack(front + 1, back), std::memory_order_acq_rel
+            )) {
+                idx = front;
+                return true;
+            }
+        }
+    }
+
+    bool pop_back(uint32_t &idx) {
+        auto r = range.load(std::memory_order_relaxed);
+        for (;;) {
+            auto front = uint32_t(r >> 32), back = uint32_t(r);
+            if (front >= back) {
+                return false;
+            }
+            if (range.compare_exchange_weak(
+                r, pack(front, back - 1), std::memory_order_acq_rel
+            )) {
+                idx = back - 1;
+                return true;
+            }
+        }
+    }
+};
+
+struct job {
+    size_t n, grain;
+    chunk_func func;
+    void *data;
+    size_t nslices;
+    std::unique_ptr<slice[]> slices;
+    /* the calling thread has the first slice, workers get the others */
+    std::atomic<size_t> next_slot{1};
+    /* workers currently inside the job, protected by the pool mutex */
+    size_t refs = 0;
+
+    void run_chunk(uint32_t idx) {
+        size_t b = size_t(idx) * grain;
+        size_t e = ((n - b) > grain) ? (b + grain) : n;
+        func(b, e, data);
+    }
+
+    void work(size_t own) {
+        uint32_t idx;
+        while (slices[own].pop_front(idx)) {
+            run_chunk(idx);
+        }
+        /* steal from the others until there is nothing left anywhere */
+        for (;;) {
+            bool found = false;
+            for (size_t i = 1; i < nslices; ++i) {
+                if (slices[(own + i) % nslices].pop_back(idx)) {
+                    run_chunk(idx);
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                return;
+            }
+        }
+    }
+};
+
+struct thread_pool {
+    thread_pool() {
+        auto hw = std::thread::hardware_concurrency();
+        /* the calling thread does its share of the work too */
+        nthreads = (hw > 1) ? (hw - 1) : 0;
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lk{mtx};
+            stop = true;
+        }
+        wcond.notify_all();
+        for (auto &t: workers) {
+            t.join();
+        }
+    }
+
+    /* must be called with the mutex held */
+    void start() {
+        if (started) {
+            return;
+        }
+        started = true;
+        try {
+            for (size_t i = 0; i < nthreads; ++i) {
+                workers.emplace_back([this]() { worker_main(); });
+            }
+        } catch (std::system_error const &) {
+            /* make do with what we got */
+        }
+        nthreads = workers.size();
+    }
+
+    void worker_main() {
+        size_t seen = 0;
+        std::unique_lock<std::mutex> lk{mtx};
+        for (;;) {
+            wcond.wait(lk, [this, &seen]() {
+                return stop || (cur && (gen != seen));
+            });
+            if (stop) {
+                return;
+            }
+            seen = gen;
+            job *jb = cur;
+            ++jb->refs;
+            lk.unlock();
+            jb->work(jb->next_slot.fetch_add(1) % jb->nslices);
+            lk.lock();
+            if (!--jb->refs) {
+                dcond.notify_all();
+            }
+        }
+    }
+
+    std::mutex mtx{};
+    std::condition_variable wcond{}; /* workers wait for jobs */
+    std::condition_variable dcond{}; /* submitters wait for workers */
+    std::vector<std::thread> workers{};
+    job *cur = nullptr;
+    size_t gen = 0;
+    size_t nthreads;
+    bool started = false;
+    bool stop = false;
+    /* held by the thread whose range is being processed */
+    std::mutex busy{};
+};
+
+static thread_pool &get_pool() {
+    static thread_pool p;
+    return p;
+}
+
+bool set_threads(size_t n) {
+    auto &p = get_pool();
+    std::lock_guard<std::mutex> lk{p.mtx};
+    if (p.started) {
+        return false;
+    }
+    p.nthreads = n;
+    return true;
+}
+
+size_t threads() {
+    auto &p = get_pool();
+    std::lock_guard<std::mutex> lk{p.mtx};
+    return p.nthreads;
+}
+
+void parallel_for(size_t n, size_t grain, chunk_func func, void *data) {
+    if (!n) {
+        return;
+    }
+    auto &p = get_pool();
+    std::unique_lock<std::mutex> blk{p.busy, std::try_to_lock};
+    size_t nthr = 0;
+    if (blk.owns_lock()) {
+        std::lock_guard<std::mutex> lk{p.mtx};
+        p.start();
+        nthr = p.nthreads;
+    }
+    if (!grain) {
+        /* a few chunks per participant leaves room for balancing */
+        grain = n / ((nthr + 1) * 8);
+        if (!grain) {
+            grain = 1;
+        }
+    }
+    /* chunk indexes have to fit into the slices */
+    size_t maxc = std::numeric_limits<uint32_t>::max();
+    if (((n - 1) / grain) >= maxc) {
+        grain = (n - 1) / maxc + 1;
+    }
+    size_t nchunks = (n - 1) / grain + 1;
+    if (!nthr || (nchunks == 1)) {
+        /* busy or nothing to split, run everything here */
+        size_t b = 0;
+        do {
+            size_t e = ((n - b) > grain) ? (b + grain) : n;
+            func(b, e, data);
+            b = e;
+        } while (b < n);
+        return;
+    }
+
+    job jb;
+    jb.n = n;
+    jb.grain = grain;
+    jb.func = func;
+    jb.data = data;
+    jb.nslices = (nchunks < (nthr + 1)) ? nchunks : (nthr + 1);
+    jb.slices = std::unique_ptr<slice[]>{new slice[jb.nslices]};
+    for (size_t i = 0; i < jb.nslices; ++i) {
+        jb.slices[i].range.store(slice::pack(
+            uint32_t(nchunks * i / jb.nslices),
+            uint32_t(nchunks * (i + 1) / jb.nslices)
+        ), std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lk{p.mtx};
+        p.cur = &jb;
+        ++p.gen;
+    }
+    p.wcond.notify_all();
+    jb.work(0);
+    /* everything is claimed, wait for the workers still running chunks */
+    std::unique_lock<std::mutex> lk{p.mtx};
+    p.cur = nullptr;
+    p.dcond.wait(lk, [&jb]() { return !jb.refs; });
+}
+
+} /* namespace pool */
@@ -0,0 +1,40 @@
+/* A process-wide thread pool for running native code in parallel.
+ *
+ * The pool is shared by all Lua states and does not touch any of them;
+ * the work items are plain C functions operating on index ranges.
+ */
+
+#ifndef POOL_HH
+#define POOL_HH
+
+#include <cstddef>
+
+namespace pool {
+
+/* called with a range [begin, end) of the whole index space */
+using chunk_func = void (*)(size_t begin, size_t end, void *data);
+
+/* sets the number of worker threads (0 means no workers, i.e. everything
+ * runs on the calling thread); the pool is started on first use and this
+ * returns false once it is running
+ */
+bool set_threads(size_t n);
+
+/* the number of worker threads the pool has (or will have) */
+size_t threads();
+
+/* runs func over [0, n) split into chunks of at most grain indexes
+ *
+ * the range is divided between the calling thread and the workers, which
+ * steal chunks from each other once they are done with their own part;
+ * the calling thread participates and this returns after all chunks are
+ * finished
+ *
+ * if the pool is busy with another range, the calling thread processes
+ * the whole range on its own
+ */
+void parallel_for(size_t n, size_t grain, chunk_func func, void *data);
+
+} /* namespace pool */
+
+#endif /* POOL_HH */
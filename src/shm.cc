@@ -0,0 +1,101 @@
+#include "platform.hh"
+
+#include <cerrno>
+
+#if FFI_OS != FFI_OS_WINDOWS
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#include "shm.hh"
+
+namespace shm {
+
+#if FFI_OS != FFI_OS_WINDOWS
+
+bool supported() {
+    return true;
+}
+
+void *map(char const *name, size_t size, bool create) {
+    if (!size) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    void *ret;
+    if (!name) {
+        ret = mmap(
+            nullptr, size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0
+        );
+        return (ret == MAP_FAILED) ? nullptr : ret;
+    }
+    int fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        goto fail;
+    }
+    if (size_t(st.st_size) < size) {
+        /* accessing a mapping past the end of the segment is a crash */
+        if (!create) {
+            errno = EINVAL;
+            goto fail;
+        }
+        if (ftruncate(fd, off_t(size)) < 0) {
+            goto fail;
+        }
+    }
+    ret = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ret == MAP_FAILED) {
+        goto fail;
+    }
+    /* the mapping keeps the segment alive by itself */
+    close(fd);
+    return ret;
+fail:
+    int err = errno;
+    close(fd);
+    errno = err;
+    return nullptr;
+}
+
+void unmap(void *addr, size_t size) {
+    munmap(addr, size);
+}
+
+bool unlink(char const *name) {
+    return !shm_unlink(name);
+}
+
+#else
+
+bool supported() {
+    return false;
+}
+
+void *map(char const *, size_t, bool) {
+    errno = ENOSYS;
+    return nullptr;
+}
+
+void unmap(void *, size_t) {
+}
+
+bool unlink(char const *) {
+    errno = ENOSYS;
+    return false;
+}
+
+#endif /* FFI_OS != FFI_OS_WINDOWS */
+
+} /* namespace shm */
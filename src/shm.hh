@@ -0,0 +1,35 @@
+/* Shared memory segments, for sharing cdata between local processes.
+ *
+ * Named segments are visible to every process that opens them by the same
+ * name; anonymous ones are only shared with processes forked afterwards.
+ */
+
+#ifndef SHM_HH
+#define SHM_HH
+
+#include <cstddef>
+
+namespace shm {
+
+/* whether shared memory is supported on this platform at all */
+bool supported();
+
+/* maps size bytes of the segment called name (or an anonymous one when
+ * name is null) into memory for reading and writing
+ *
+ * with create, the segment is created when it does not exist and grown
+ * to size when it is smaller; otherwise a segment smaller than size
+ * fails with EINVAL
+ *
+ * returns null and sets errno on failure
+ */
+void *map(char const *name, size_t size, bool create);
+
+void unmap(void *addr, size_t size);
+
+/* removes the name of the segment; existing mappings remain valid */
+bool unlink(char const *name);
+
+} /* namespace shm */
+
+#endif /* SHM_HH */
@@ -0,0 +1,55 @@
+/* Counters of allocations and conversions, for finding hot spots.
+ *
+ * These are only compiled in when building with the stats option; the
+ * counters are per thread, so that counting needs no synchronization,
+ * and otherwise the counting functions do nothing at all.
+ */
+
+#ifndef STATS_HH
+#define STATS_HH
+
+#include <cstddef>
+
+#include "platform.hh"
+
+namespace stats {
+
+enum counter {
+    CDATA_SCALAR = 0, /* cdata created, by kind */
+    CDATA_POINTER,
+    CDATA_RECORD,
+    CDATA_ARRAY,
+    CDATA_FUNC,
+    CDATA_CALLBACK,
+    BYTES,            /* bytes allocated for cdata and outside of Lua */
+    TYPE_COPIES,      /* c_type nodes copied onto the heap */
+    PREP_CIF,         /* ffi_prep_cif calls */
+    PREP_CIF_VAR,     /* ffi_prep_cif_var calls */
+    REF_FINALIZER,    /* registry references made for finalizers */
+    REF_CALLBACK,     /* registry references made for callbacks */
+    SLOW_TO_LUA,      /* numbers that had to be boxed into cdata */
+    SLOW_FROM_LUA,    /* values converted from cdata numbers or tables */
+    COUNTER_MAX
+};
+
+#ifdef HAVE_STATS
+
+static constexpr bool enabled = true;
+
+extern thread_local size_t counters[COUNTER_MAX];
+
+static inline void count(counter c, size_t n = 1) {
+    counters[c] += n;
+}
+
+#else
+
+static constexpr bool enabled = false;
+
+static inline void count(counter, size_t = 1) {}
+
+#endif /* HAVE_STATS */
+
+} /* namespace stats */
+
+#endif /* STATS_HH */
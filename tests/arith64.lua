@@ -0,0 +1,66 @@
+local ffi = require("cffi")
+
+local i64 = function(v) return ffi.new("int64_t", v) end
+local u64 = function(v) return ffi.new("uint64_t", v) end
+
+-- results are boxed as signed unless either side is unsigned
+local r = i64(5) + 3
+assert(ffi.istype("long long", r))
+assert(ffi.tonumber(r) == 8)
+r = u64(5) + i64(3)
+assert(ffi.istype("unsigned long long", r))
+assert(ffi.tonumber(r) == 8)
+assert(ffi.tonumber(ffi.new("int", 2) * 3) == 6)
+assert(ffi.istype("long long", ffi.new("int", 2) * 3))
+
+assert(ffi.tonumber(i64(7) - 10) == -3)
+assert(ffi.tonumber(i64(7) * -2) == -14)
+assert(ffi.tonumber(i64(-7) / 2) == -3)
+assert(ffi.tonumber(i64(-7) % 2) == -1)
+assert(ffi.tonumber(i64(3) ^ 4) == 81)
+assert(ffi.tonumber(-i64(5)) == -5)
+
+-- unsigned wraps around
+local umax = ffi.cast("uint64_t", -1)
+assert(umax + 1 == u64(0))
+assert(ffi.istype("unsigned long long", -u64(1)))
+assert(-u64(1) == umax)
+
+-- so does signed overflow
+local imax = ffi.cast("long long", umax / 2)
+assert(imax + 1 < i64(0))
+
+-- comparisons against cdata and numbers
+assert(i64(-1) < i64(0))
+assert(not (u64(0) > ffi.cast("uint64_t", -1)))
+assert(i64(5) <= 5)
+assert(3 < i64(5))
+assert(i64(5) == i64(5))
+assert(i64(5) == u64(5))
+
+if _VERSION ~= "Lua 5.1" and _VERSION ~= "Lua 5.2" then
+    assert(ffi.tonumber(i64(6) & 3) == 2)
+    assert(ffi.tonumber(i64(6) | 1) == 7)
+    assert(ffi.tonumber(i64(6) ~ 3) == 5)
+    assert(ffi.tonumber(~i64(0)) == -1)
+    assert(ffi.tonumber(i64(1) << 40) == 2 ^ 40)
+    assert(ffi.tonumber(i64(-16) >> 2) == -4)
+    assert(u64(1) << 63 == umax - umax / 2)
+    -- negative counts shift the other way
+    assert(ffi.tonumber(i64(16) << -2) == 4)
+    assert(ffi.tonumber(i64(1) >> -3) == 8)
+    -- counts past the width shift everything out
+    assert(ffi.tonumber(u64(1) << 64) == 0)
+    assert(ffi.tonumber(i64(1) << 100) == 0)
+    assert(ffi.tonumber(u64(8) >> 64) == 0)
+    assert(ffi.tonumber(i64(-8) >> 200) == -1)
+    assert(ffi.tonumber(i64(8) >> -64) == 0)
+    local imin = -imax - 1
+    assert(ffi.tonumber(i64(-8) << imin) == -1)
+    assert(ffi.tonumber(i64(8) >> imin) == 0)
+    -- unsigned counts are never negative
+    local big = u64(1) << 63
+    assert(ffi.tonumber(i64(-8) >> big) == -1)
+    assert(ffi.tonumber(u64(8) << big) == 0)
+    assert(ffi.tonumber(i64(7) // 2) == 3)
+end
@@ -0,0 +1,74 @@
+local ffi = require("cffi")
+local atomic = ffi.atomic
+
+ffi.cdef [[
+    struct counters {
+        char tag;
+        int hits;
+        unsigned long long bytes;
+        void *last;
+    };
+]]
+
+-- pointers and arrays
+local a = ffi.new("int[4]")
+local p = ffi.cast("int *", a) + 2
+atomic.store(p, 5)
+assert(atomic.load(p) == 5)
+assert(a[2] == 5)
+assert(atomic.add(p, 3) == 5)
+assert(atomic.sub(p, 1) == 8)
+assert(atomic.load(p, "acquire") == 7)
+assert(atomic.exchange(a, 9) == 0)
+assert(a[0] == 9)
+
+-- bitwise, by the plain names too
+atomic.store(p, 0xF0, "release")
+assert(atomic["and"](p, 0x3C) == 0xF0)
+assert(atomic["or"](p, 0x01) == 0x30)
+assert(atomic.bxor(p, 0xFF) == 0x31)
+assert(a[2] == 0xCE)
+
+-- compare and swap returns the current value on failure
+local ok, cur = atomic.cas(p, 1, 2)
+assert(not ok and cur == 0xCE)
+ok, cur = atomic.cas(p, 0xCE, 2, "acq_rel")
+assert(ok and cur == 0xCE)
+assert(a[2] == 2)
+
+-- record fields, through a value, a pointer or a reference
+local c = ffi.new("struct counters")
+assert(atomic.add(c, "hits", 1) == 0)
+local cp = ffi.cast("struct counters *", c)
+assert(atomic.add(cp, "hits", 1) == 1)
+assert(atomic.add(cp[0], "hits", 1) == 2)
+assert(c.hits == 3)
+
+-- 64-bit values stay exact
+local umax = ffi.cast("unsigned long long", -1)
+atomic.store(c, "bytes", umax)
+assert(atomic.load(c, "bytes") == umax)
+assert(atomic.add(c, "bytes", 2) == umax)
+assert(ffi.tonumber(c.bytes) == 1)
+
+-- pointers
+assert(atomic.exchange(c, "last", p) == ffi.nullptr)
+assert(atomic.load(c, "last") == ffi.cast("void *", p))
+ok = atomic.cas(c, "last", p, nil)
+assert(ok and c.last == ffi.nullptr)
+
+-- bad operands and orders
+assert(not pcall(atomic.load, c, "nope"))
+assert(not pcall(atomic.add, ffi.new("double[1]"), 1))
+assert(not pcall(atomic.store, ffi.cast("int const *", a), 1))
+assert(not pcall(atomic.load, p, "release"))
+assert(not pcall(atomic.store, p, 1, "acquire"))
+assert(not pcall(atomic.load, p, "bogus"))
+assert(not pcall(atomic.load, ffi.cast("int *", ffi.cast("char *", a) + 1)))
+assert(not pcall(atomic.load, 5))
+
+-- doubles may be loaded, stored and exchanged
+local d = ffi.new("double[1]", 1.5)
+assert(atomic.exchange(d, 2.5) == 1.5)
+assert(atomic.load(d) == 2.5)
+
@@ -0,0 +1,59 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    double frexp(double x, int *exp);
+    double modf(double x, double *iptr);
+    long strtol(char const *s, char **end, int base);
+    typedef struct { int a; int b; } pair_t;
+    typedef struct { double v[10]; } cffi_test_wide;
+    void cffi_test_out_cb(
+        int v, int *out, cffi_test_wide *wout, void (*cb)(int)
+    );
+]]
+
+local frexp = ffi.bind(ffi.C.frexp, { out = { 2 } })
+local m, e = frexp(8)
+assert(m == 0.5)
+assert(e == 4)
+
+local modf = ffi.bind(ffi.C.modf, { out = { 2 } })
+local f, i = modf(3.25)
+assert(f == 0.25)
+assert(i == 3)
+
+-- out-parameters are removed from the middle of the argument list
+local strtol = ffi.bind(ffi.C.strtol, { out = { 2 } })
+local v, endp = strtol("ff zz", 16)
+assert(v == 255)
+assert(ffi.string(endp) == " zz")
+
+-- storage is zeroed for every call
+v, endp = strtol("12", 10)
+assert(v == 12)
+assert(ffi.string(endp) == "")
+
+-- no out-parameters just forwards the call
+local plain = ffi.bind(ffi.C.frexp, {})
+assert(plain(8, ffi.new("int[1]")) == 0.5)
+
+-- reentrant calls get their own storage
+local outcb = ffi.bind(ffi.C.cffi_test_out_cb, { out = { 2 } })
+local wide = ffi.bind(ffi.C.cffi_test_out_cb, { out = { 2, 3 } })
+local cb
+cb = ffi.cast("void (*)(int)", function(n)
+    if n > 0 then
+        assert(outcb(n, nil, cb) == n)
+        local o, w = wide(n, cb)
+        assert(o == n and w.v[9] == n)
+    end
+end)
+assert(outcb(3, nil, cb) == 3)
+local o, w = wide(3, cb)
+assert(o == 3 and w.v[0] == 3 and w.v[9] == 3)
+cb:free()
+
+-- invalid specifications
+assert(not pcall(ffi.bind, ffi.C.strtol, { out = { 3 } }))
+assert(not pcall(ffi.bind, ffi.C.strtol, { out = { 4 } }))
+assert(not pcall(ffi.bind, ffi.C.strtol, { out = { 2, 2 } }))
+assert(not pcall(ffi.bind, ffi.new("pair_t"), { out = { 1 } }))
@@ -0,0 +1,73 @@
+local ffi = require("cffi")
+
+local buf = ffi.new("char[16]")
+ffi.copy(buf, "abcdefgh")
+
+-- overlapping moves in both directions
+ffi.move(ffi.cast("char *", buf) + 2, buf, 6)
+assert(ffi.string(buf) == "ababcdef")
+ffi.move(buf, ffi.cast("char *", buf) + 2, 6)
+assert(ffi.string(buf, 6) == "abcdef")
+ffi.move(buf, "xyz", 3)
+assert(ffi.string(buf, 6) == "xyzdef")
+assert(not pcall(ffi.move, buf, "xyz", 4))
+
+assert(ffi.compare(buf, "xyzdef", 6) == 0)
+assert(ffi.compare(buf, "xyzdeg", 6) == -1)
+assert(ffi.compare("xz", buf, 2) == 1)
+assert(ffi.compare(buf, buf, 0) == 0)
+
+-- delimiter scanning
+local line = "key=value;k2=v2;;end"
+local p = ffi.view(line)
+assert(ffi.find(p, #line, ";") == 9)
+assert(ffi.find(p, #line, string.byte(";")) == 9)
+assert(ffi.find(p, #line, ";", 10) == 15)
+assert(ffi.find(p, #line, ";;") == 15)
+assert(ffi.find(p, #line, "end") == 17)
+assert(ffi.find(p, #line - 1, "end") == nil)
+assert(ffi.find(p, #line, "#") == nil)
+assert(ffi.find(p, #line, "", 4) == 4)
+assert(ffi.find(p, #line, ";", #line) == nil)
+assert(ffi.find(p, #line, "x", #line + 1) == nil)
+
+assert(ffi.count(p, #line, string.byte(";")) == 3)
+assert(ffi.count(p, #line, string.byte("#")) == 0)
+assert(ffi.count(p, 0, string.byte("k")) == 0)
+assert(ffi.count(p, #line, string.byte("d")) == 1)
+
+-- gather a field out of an array of structs and scatter it back
+ffi.cdef [[
+    struct bulk_pt { int x; int y; };
+]]
+local pts = ffi.new("struct bulk_pt[4]")
+for i = 0, 3 do
+    pts[i].x = i
+    pts[i].y = i * 10
+end
+local sz, isz = ffi.sizeof("struct bulk_pt"), ffi.sizeof("int")
+local ys = ffi.new("int[4]")
+local py = ffi.cast("char *", pts) + ffi.offsetof("struct bulk_pt", "y")
+ffi.copy_strided(ys, isz, py, sz, 4, isz)
+for i = 0, 3 do
+    assert(ys[i] == i * 10)
+end
+
+-- negative strides reverse
+local rev = ffi.new("int[4]")
+ffi.copy_strided(ffi.cast("int *", rev) + 3, -isz, ys, isz, 4, isz)
+assert(rev[0] == 30 and rev[3] == 0)
+
+ffi.fill_strided(py, sz, 4, isz)
+ffi.fill_strided(pts, sz, 2, isz, 255)
+for i = 0, 3 do
+    assert(pts[i].y == 0)
+    assert(pts[i].x == ((i < 2) and -1 or i))
+end
+
+-- contiguous elements
+local arr = ffi.new("int[4]")
+ffi.copy_strided(arr, isz, ys, isz, 4, isz)
+assert(arr[3] == 30)
+ffi.fill_strided(arr, isz, 4, isz)
+assert(arr[0] == 0 and arr[3] == 0)
@@ -0,0 +1,39 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    typedef struct { int quot; int rem; } div_t;
+    typedef struct { long quot; long rem; } ldiv_t;
+    div_t div(int num, int den);
+    ldiv_t ldiv(long num, long den);
+    unsigned long long strtoull(char const *s, char **end, int base);
+    int abs(int v);
+]]
+
+local d = ffi.new("div_t")
+assert(ffi.C.div:into(d, 17, 5) == d)
+assert(d.quot == 3)
+assert(d.rem == 2)
+
+local ld = ffi.new("ldiv_t")
+ffi.C.ldiv:into(ld, 100, 7)
+assert(ld.quot == 14)
+assert(ld.rem == 2)
+
+-- through a pointer
+local arr = ffi.new("div_t[2]")
+ffi.C.div:into(ffi.cast("div_t *", arr) + 1, 9, 4)
+assert(arr[1].quot == 2)
+assert(arr[1].rem == 1)
+
+-- large scalars are stored without boxing a new cdata
+local u = ffi.new("unsigned long long")
+ffi.C.strtoull:into(u, "18446744073709551615", nil, 10)
+assert(u == ffi.eval("18446744073709551615ULL"))
+
+assert(not pcall(ffi.C.div.into, ffi.C.div, ld, 1, 1))
+
+-- missing arguments are not taken from the destination
+local n = ffi.new("int", -7)
+assert(not pcall(ffi.C.abs.into, ffi.C.abs, n))
+assert(ffi.tonumber(n) == -7)
+assert(not pcall(ffi.C.div.into, ffi.C.div, d, 1))
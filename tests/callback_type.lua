@@ -0,0 +1,27 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    int abs(int v);
+]]
+
+-- callbacks and function pointers outlive the ctype they are made from
+local cb = ffi.cast(ffi.typeof("int (*)(int, int)"), function(a, b)
+    return a * b
+end)
+local fp = ffi.cast(ffi.typeof("int (*)(int)"), ffi.C.abs)
+local fpn = ffi.new(ffi.typeof("int (*)(int)"), ffi.C.abs)
+
+for i = 1, 4 do
+    -- churn through the heap so that freed signatures get reused
+    for j = 1, 100 do
+        ffi.typeof("int (*)(int, int, double, char *, long)")
+        ffi.new("double[8]")
+    end
+    collectgarbage()
+    collectgarbage()
+    assert(cb(i, 3) == i * 3)
+    assert(fp(-i) == i)
+    assert(fpn(-i) == i)
+end
+
+cb:free()
@@ -0,0 +1,60 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct hdr {
+        uint16_t kind;
+        uint16_t len;
+    };
+]]
+
+local buf = ffi.new("int[4]", { 10, 20, 30, 40 })
+local p = ffi.cast("int *", buf)
+
+-- advance moves the pointer in place
+assert(ffi.advance(p, 2) == p)
+assert(p[0] == 30)
+ffi.advance(p, -1)
+assert(p[0] == 20)
+
+local cur = ffi.cursor(buf)
+assert(cur:next() == 10)
+assert(cur:next() == 20)
+assert(cur:offset() == 8)
+assert(cur:ptr()[0] == 30)
+cur:skip(4)
+assert(cur:next() == 40)
+-- arrays of known size are bounds checked
+assert(not pcall(cur.next, cur))
+
+-- typed reads from a string, unaligned
+local data = "\1" .. string.char(7, 0, 3, 0) .. "abc"
+cur = ffi.cursor(data)
+assert(cur:read("uint8_t") == 1)
+local hdr = ffi.typeof("struct hdr")
+local h = cur:read(hdr)
+assert(h.kind == 7)
+assert(h.len == 3)
+assert(ffi.string(cur:ptr(), 3) == "abc")
+cur:skip(3)
+assert(not pcall(cur.read, cur, "uint8_t"))
+cur:skip(-3)
+assert(cur:read("char") == string.byte("a"))
+-- seeking back by the smallest integer is an error, not an overflow
+if math.mininteger then
+    assert(not pcall(cur.skip, cur, math.mininteger))
+end
+assert(cur:read("char") == string.byte("b"))
+
+-- references to arrays, such as array members of records
+ffi.cdef [[
+    struct cur_msg {
+        int id;
+        uint16_t vals[3];
+    };
+]]
+local msg = ffi.new("struct cur_msg", { 1, { 4, 5, 6 } })
+cur = ffi.cursor(msg.vals)
+assert(cur:next() == 4)
+assert(cur:next() == 5)
+assert(cur:next() == 6)
+assert(not pcall(cur.next, cur))
@@ -0,0 +1,52 @@
+local ffi = require("cffi")
+
+local base = ffi.declstats()
+assert(base.records >= 0 and base.functions >= 0)
+assert(#base.cdefs == 0)
+assert(base.parse_time == 0)
+
+ffi.cdef [[
+    struct ds_point { int x; int y; };
+    union ds_val { int i; float f; };
+    typedef struct ds_point ds_point_t;
+    enum ds_color { DS_RED, DS_GREEN, DS_BLUE };
+    int abs(int value);
+    extern int errno;
+]]
+
+local st = ffi.declstats()
+assert(st.records == base.records + 2)
+assert(st.typedefs == base.typedefs + 1)
+assert(st.enums == base.enums + 1)
+assert(st.enum_fields == base.enum_fields + 3)
+assert(st.functions == base.functions + 1)
+assert(st.variables == base.variables + 1)
+-- enum fields are not counted as constants
+assert(st.constants == base.constants)
+
+assert(st.ast_bytes > base.ast_bytes)
+-- two records with two fields each, each terminated by a null
+assert(st.ffi_bytes == base.ffi_bytes + 6 * ffi.sizeof("void *"))
+-- declaration, field and parameter names
+assert(st.name_bytes > base.name_bytes + #"ds_point" + #"value")
+
+assert(#st.cdefs == 1)
+local c = st.cdefs[1]
+assert(c.decls == 9)
+assert(c.size > 50)
+assert(c.time >= 0)
+assert(st.parse_time == c.time)
+
+-- each call is timed separately
+ffi.cdef [[ int labs(int value); ]]
+st = ffi.declstats()
+assert(#st.cdefs == 2)
+assert(st.cdefs[2].decls == 1)
+assert(st.parse_time >= st.cdefs[1].time)
+
+-- frozen declarations are still counted
+ffi.freeze()
+local fst = ffi.declstats()
+assert(fst.records == st.records)
+assert(fst.functions == st.functions)
+assert(#fst.cdefs == 2)
@@ -0,0 +1,74 @@
+local ffi = require("cffi")
+
+local umax = ffi.cast("uint64_t", -1)
+
+-- the same object is updated and returned
+local x = ffi.new("uint64_t", 10)
+local y = ffi.iadd(x, 5)
+assert(rawequal(x, y))
+assert(x == ffi.new("uint64_t", 15))
+ffi.isub(x, ffi.new("int", 20))
+assert(x == umax - 4)
+ffi.iadd(x, 5)
+assert(ffi.tonumber(x) == 0)
+
+local h = ffi.new("int64_t", 7)
+ffi.imul(h, -3)
+assert(ffi.tonumber(h) == -21)
+ffi.ibor(h, 1)
+assert(ffi.tonumber(h) == -21)
+ffi.iband(h, 0xFF)
+assert(ffi.tonumber(h) == 235)
+ffi.ibxor(h, 0x0F)
+assert(ffi.tonumber(h) == 228)
+ffi.ishl(h, 4)
+assert(ffi.tonumber(h) == 3648)
+ffi.ishr(h, 6)
+assert(ffi.tonumber(h) == 57)
+-- negative counts shift the other way
+ffi.ishl(h, -3)
+assert(ffi.tonumber(h) == 7)
+
+-- signed right shifts keep the sign, unsigned ones do not
+local s = ffi.new("int32_t", -64)
+ffi.ishr(s, 4)
+assert(ffi.tonumber(s) == -4)
+ffi.ishr(s, 100)
+assert(ffi.tonumber(s) == -1)
+ffi.ishl(s, 64)
+assert(ffi.tonumber(s) == 0)
+s = ffi.new("int64_t", -64)
+ffi.ishr(s, umax - umax / 2)
+assert(ffi.tonumber(s) == -1)
+ffi.ishr(s, ffi.cast("int64_t", umax - umax / 2))
+assert(ffi.tonumber(s) == 0)
+local u = ffi.new("uint32_t", 0x80000000)
+ffi.ishr(u, 31)
+assert(ffi.tonumber(u) == 1)
+
+-- results wrap around in the width of the target
+local b = ffi.new("uint8_t", 250)
+ffi.iadd(b, 10)
+assert(ffi.tonumber(b) == 4)
+local c = ffi.new("int16_t", 32767)
+ffi.iadd(c, 1)
+assert(ffi.tonumber(c) == -32768)
+
+-- a checksum that does not allocate anything per step
+local sum = ffi.new("uint64_t", 0)
+local ncdata = ffi.memstats().count
+for i = 1, 100 do
+    ffi.imul(sum, 31)
+    ffi.iadd(sum, i)
+end
+assert(ffi.memstats().count == ncdata)
+local ref = ffi.new("uint64_t", 0)
+for i = 1, 100 do
+    ref = ref * 31 + i
+end
+assert(sum == ref)
+
+assert(not pcall(ffi.iadd, ffi.new("double", 1), 1))
+assert(not pcall(ffi.iadd, ffi.new("bool", true), 1))
+assert(not pcall(ffi.iadd, ffi.new("const int", 1), 1))
+assert(not pcall(ffi.iadd, 5, 1))
@@ -0,0 +1,36 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    int printf(char const *fmt, ...);
+]]
+
+collectgarbage()
+local base = ffi.memstats()
+assert(base.count > 0)
+
+local objs = {}
+for i = 1, 100 do
+    objs[i] = ffi.new("int *[4]")
+end
+local st = ffi.memstats()
+assert(st.count == base.count + 100)
+assert(st.cdata > base.cdata)
+-- pointer element types are owned by each cdata
+assert(st.ctype > base.ctype)
+
+local cb = ffi.cast("int (*)(int)", function(x) return x end)
+st = ffi.memstats()
+assert(st.closure > base.closure)
+cb:free()
+assert(ffi.memstats().closure == base.closure)
+
+local pf = ffi.C.printf
+pf("%s", "")
+
+assert(st.external >= st.ctype + st.closure)
+
+objs, pf = nil, nil
+collectgarbage()
+collectgarbage()
+st = ffi.memstats()
+assert(st.count <= base.count + 1)
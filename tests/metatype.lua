@@ -0,0 +1,63 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct mt_vec { int x; int y; };
+    struct mt_handle { int id; };
+]]
+
+local methods = {
+    sum = function(v) return v.x + v.y end
+}
+
+local vec_mt = {
+    __index = methods,
+    __add = function(a, b)
+        return ffi.new("struct mt_vec", a.x + b.x, a.y + b.y)
+    end,
+    __eq = function(a, b) return a.x == b.x and a.y == b.y end,
+    __len = function(v) return 2 end,
+    __tostring = function(v) return "vec(" .. v.x .. ", " .. v.y .. ")" end,
+    __call = function(v, n) return v.x * n end,
+}
+local vec = ffi.metatype("struct mt_vec", vec_mt)
+
+local a = vec(1, 2)
+local b = ffi.new("struct mt_vec", 3, 4)
+assert(a:sum() == 3)
+assert((a + b):sum() == 10)
+assert(a + b == vec(4, 6))
+assert(#a == 2)
+assert(tostring(b) == "vec(3, 4)")
+assert(a(5) == 5)
+
+-- pointers to the record use the same metatype
+local p = ffi.new("struct mt_vec *", a)
+assert(p:sum() == 3)
+
+-- the contents of an __index table are used as is
+methods.diff = function(v) return v.y - v.x end
+assert(b:diff() == 1)
+
+-- the metamethods are resolved on assignment
+vec_mt.__len = function() return 3 end
+vec_mt.__sub = function() return 0 end
+assert(#a == 2)
+assert(not pcall(function() return a - b end))
+
+-- __index and __newindex functions get the key
+local store = {}
+ffi.metatype("struct mt_handle", {
+    __index = function(h, k) return store[k] end,
+    __newindex = function(h, k, v) store[k] = v end,
+    __gc = function(h) store.collected = h.id end,
+})
+local h = ffi.new("struct mt_handle", 7)
+h.name = "seven"
+assert(h.name == "seven")
+assert(h.id == 7)
+h = nil
+collectgarbage()
+collectgarbage()
+assert(store.collected == 7)
+
+assert(not pcall(ffi.metatype, "struct mt_vec", {}))
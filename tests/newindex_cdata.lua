@@ -0,0 +1,44 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct nc_rec {
+        int i;
+        double d;
+        int *p;
+        bool b;
+    };
+]]
+
+-- scalar cdata are stored by value, not dropped
+local arr = ffi.new("int[4]")
+arr[2] = ffi.new("int", 5)
+assert(arr[2] == 5)
+arr[3] = ffi.new("long long", 7)
+assert(arr[3] == 7)
+local ptr = ffi.cast("int *", arr)
+ptr[1] = ffi.new("short", -3)
+assert(arr[1] == -3)
+
+-- the generic path of records and other element types
+local r = ffi.new("struct nc_rec")
+r.i = ffi.new("int", 9)
+r.d = ffi.new("double", 0.25)
+r.p = ptr
+r.b = ffi.new("bool", true)
+assert(r.i == 9)
+assert(r.d == 0.25)
+assert(r.p == ptr)
+assert(r.b == true)
+
+-- records are copied into elements
+local ra = ffi.new("struct nc_rec[2]")
+ra[1] = r
+r.i = 1
+assert(ra[1].i == 9 and ra[1].d == 0.25)
+
+local ba = ffi.new("bool[2]")
+ba[1] = ffi.new("bool", true)
+assert(ba[1] == true)
+local pa = ffi.new("int *[2]")
+pa[0] = ptr + 2
+assert(pa[0][0] == 5)
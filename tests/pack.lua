@@ -0,0 +1,108 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    enum pk_kind { PK_A = 1, PK_B = 2 };
+    struct pk_pt { short x; short y; };
+    struct pk_msg {
+        unsigned char ver;
+        unsigned int len;
+        enum pk_kind kind;
+        struct pk_pt pts[2];
+        char name[6];
+        double val;
+        bool ok;
+    };
+]]
+
+-- array members are laid out in place
+assert(ffi.offsetof("struct pk_msg", "pts") == 12)
+assert(ffi.offsetof("struct pk_msg", "name") == 20)
+assert(ffi.offsetof("struct pk_msg", "val") == 32)
+assert(ffi.sizeof("struct pk_msg") == 48)
+
+local msg = {
+    ver = 1, len = 0x01020304, kind = 2,
+    pts = { { x = 1, y = -2 }, { x = 3 } },
+    name = "hello", val = 0.5, ok = true
+}
+
+-- the native encoding matches the memory of the cdata
+local s = ffi.pack("struct pk_msg", msg)
+assert(#s == ffi.sizeof("struct pk_msg"))
+local buf = ffi.new("struct pk_msg[1]")
+ffi.copy(buf, s, #s)
+local cd = buf[0]
+assert(cd.ver == 1 and cd.len == 0x01020304 and cd.kind == 2)
+assert(cd.pts[0].x == 1 and cd.pts[0].y == -2 and cd.pts[1].x == 3)
+assert(cd.pts[1].y == 0)
+assert(ffi.string(cd.name) == "hello" and cd.val == 0.5 and cd.ok == true)
+
+-- cdata values are packed straight from memory
+assert(ffi.pack("struct pk_msg", cd) == s)
+assert(ffi.pack("struct pk_msg", ffi.cast("struct pk_msg *", buf)) == s)
+assert(ffi.unpack(
+    "struct pk_msg", ffi.pack("struct pk_msg", ffi.new("struct pk_msg", 7))
+).ver == 7)
+
+local function check(t)
+    assert(t.ver == 1 and t.len == 0x01020304 and t.kind == 2)
+    assert(t.pts[1].x == 1 and t.pts[1].y == -2)
+    assert(t.pts[2].x == 3 and t.pts[2].y == 0)
+    assert(t.name == "hello" and t.val == 0.5 and t.ok == true)
+end
+
+local t, nxt = ffi.unpack("struct pk_msg", s)
+check(t)
+assert(nxt == #s)
+
+-- packed big endian encoding
+local be = { endian = "big", packed = true }
+local p = ffi.pack("struct pk_msg", msg, be)
+assert(#p == 1 + 4 + 4 + 8 + 6 + 8 + 1)
+assert(p:sub(1, 5) == "\1\1\2\3\4")
+assert(p:sub(10, 13) == "\0\1\255\254")
+assert(ffi.pack("struct pk_msg", cd, be) == p)
+t = ffi.unpack("struct pk_msg", "xx" .. p .. "yy", 2, be)
+check(t)
+local le = ffi.pack("struct pk_msg", msg, { endian = "little", packed = true })
+assert(le:sub(2, 5) == "\4\3\2\1")
+
+-- consecutive messages in one string
+local two = p .. ffi.pack("struct pk_msg", { ver = 2 }, be)
+local off = 0
+local vers = {}
+while off < #two do
+    t, off = ffi.unpack("struct pk_msg", two, off, be)
+    vers[#vers + 1] = t.ver
+end
+assert(#vers == 2 and vers[1] == 1 and vers[2] == 2)
+
+-- scalars and arrays as the root
+assert(ffi.pack("uint16_t", 0x0102, { endian = "big" }) == "\1\2")
+assert(ffi.unpack("uint16_t", "\1\2", 0, { endian = "big" }) == 0x0102)
+local arr = ffi.unpack("int8_t[3]", ffi.pack("int8_t[3]", { 1, -1 }))
+assert(arr[1] == 1 and arr[2] == -1 and arr[3] == 0)
+
+-- errors
+assert(not pcall(ffi.unpack, "struct pk_msg", p))
+assert(not pcall(ffi.pack, "struct pk_msg", { name = "too long" }))
+assert(not pcall(ffi.pack, "struct pk_msg", { pts = 5 }))
+assert(not pcall(ffi.pack, "int *", nil))
+assert(not pcall(ffi.pack, "union { int x; }", {}))
+assert(not pcall(ffi.pack, "int", 1, { endian = "middle" }))
+
+-- cached plans outlive the ctype they were made from
+ffi.cdef [[
+    struct pk_tmp {
+        int a;
+    };
+]]
+assert(#ffi.pack(ffi.typeof("struct pk_tmp"), { a = 1 }) == 4)
+for i = 1, 100 do
+    ffi.typeof("struct pk_tmp *[4]")
+end
+collectgarbage()
+collectgarbage()
+local ok, err = pcall(ffi.pack, ffi.typeof("struct pk_tmp"), 5)
+assert(not ok and err:find("struct pk_tmp", 1, true))
+assert(ffi.unpack("struct pk_tmp", "\0\0\0\0").a == 0)
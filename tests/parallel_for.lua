@@ -0,0 +1,65 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    void cffi_test_axpy(
+        size_t b, size_t e, double a, double const *x, double *y
+    );
+]]
+
+local kern = ffi.C.cffi_test_axpy
+
+assert(ffi.threads() >= 0)
+
+local n = 100000
+local x = ffi.new("double[?]", n)
+local y = ffi.new("double[?]", n)
+for i = 0, n - 1 do
+    x[i] = i
+    y[i] = 1
+end
+
+ffi.parallel_for(kern, n, 2, x, y)
+for i = 0, n - 1, 997 do
+    assert(y[i] == 2 * i + 1)
+end
+-- every index is visited exactly once
+local ok = true
+for i = 0, n - 1 do
+    if y[i] ~= 2 * i + 1 then
+        ok = false
+        break
+    end
+end
+assert(ok)
+
+-- explicit grain
+ffi.parallel_for(kern, n, 1000, -2, x, y)
+assert(y[n - 1] == 1)
+assert(y[12345] == 1)
+
+-- odd sizes and grains larger than the range
+ffi.parallel_for(kern, 7, 100, 1, x, y)
+assert(y[6] == 7)
+assert(y[7] == 1)
+ffi.parallel_for(kern, 0, 1, x, y)
+
+-- the pool is already running now
+assert(not pcall(ffi.threads, 2))
+
+-- invalid kernels and arguments
+assert(not pcall(ffi.parallel_for, ffi.cast("void (*)(size_t, size_t)",
+    function() end), 10))
+assert(not pcall(ffi.parallel_for, kern, 10, x))
+assert(not pcall(ffi.parallel_for, ffi.C.cffi_test_axpy, -1, 1, x, y))
+
+-- the range has to fit the kernel's index types
+local ikern = ffi.cast(
+    "void (*)(int, int, double, double const *, double *)", kern
+)
+assert(not pcall(ffi.parallel_for, ikern, 2^32 + 5, 1, x, y))
+assert(not pcall(ffi.parallel_for, ikern, 2^31, 1, x, y))
+local ckern = ffi.cast(
+    "void (*)(unsigned char, unsigned char, double, double const *, double *)",
+    kern
+)
+assert(not pcall(ffi.parallel_for, ckern, 256, 1, x, y))
@@ -0,0 +1,68 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    int abs(int v);
+    size_t strlen(char const *s);
+    void qsort(
+        void *base, size_t nmemb, size_t size,
+        int (*compar)(void const *, void const *)
+    );
+]]
+
+-- nothing is recorded while stopped
+ffi.C.abs(-5)
+assert(#ffi.profile.report() == 0)
+
+ffi.profile.start()
+for i = 1, 10 do
+    assert(ffi.C.abs(-i) == i)
+end
+assert(ffi.tonumber(ffi.C.strlen("hello")) == 5)
+
+local cmp = ffi.cast("int (*)(void const *, void const *)", function(a, b)
+    local x = ffi.cast("int const *", a)[0]
+    local y = ffi.cast("int const *", b)[0]
+    return x - y
+end)
+local arr = ffi.new("int[4]", 3, 1, 4, 2)
+ffi.C.qsort(arr, 4, ffi.sizeof("int"), cmp)
+assert(arr[0] == 1 and arr[3] == 4)
+ffi.profile.stop()
+
+-- calls after stopping are not counted
+ffi.C.abs(-1)
+
+local rep = ffi.profile.report()
+local byname = {}
+local cbs = 0
+for i, e in ipairs(rep) do
+    assert(type(e.name) == "string")
+    assert(e.time >= 0 and e.max >= 0 and e.args >= 0 and e.ret >= 0)
+    assert(e.max <= e.time)
+    if e.callback then
+        cbs = cbs + e.calls
+    else
+        byname[e.name] = e
+    end
+    -- sorted by total time
+    if i > 1 then
+        local p = rep[i - 1]
+        assert(p.time + p.args + p.ret >= e.time + e.args + e.ret)
+    end
+end
+assert(byname.abs.calls == 10)
+assert(byname.strlen.calls == 1)
+assert(byname.qsort.calls == 1)
+assert(cbs >= 3)
+
+-- the callback time is included in the time of qsort
+assert(byname.qsort.time > 0)
+
+-- starting again clears the data
+ffi.profile.start()
+ffi.C.abs(-1)
+ffi.profile.stop()
+rep = ffi.profile.report()
+assert(#rep == 1 and rep[1].name == "abs" and rep[1].calls == 1)
+
+cmp:free()
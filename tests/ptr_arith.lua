@@ -0,0 +1,25 @@
+local ffi = require("cffi")
+
+-- integer offsets are scaled by the size of the pointed-to type
+local a = ffi.new("int[8]", { 0, 1, 2, 3, 4, 5, 6, 7 })
+local p = ffi.cast("int *", a)
+assert((p + 3)[0] == 3)
+assert((2 + p)[0] == 2)
+assert(((p + 5) - 4)[0] == 1)
+assert(ffi.tonumber((p + 6) - p) == 6)
+
+local d = ffi.new("double[4]", { 0.5, 1.5, 2.5, 3.5 })
+local dp = ffi.cast("double *", d) + 2
+assert(dp[0] == 2.5)
+assert((dp - 1)[0] == 1.5)
+assert((dp + ffi.new("int", 1))[0] == 3.5)
+
+ffi.cdef [[
+    struct pa_pt { int x; double y; };
+]]
+local s = ffi.new("struct pa_pt[3]")
+s[2].x = 42
+local sp = ffi.cast("struct pa_pt *", s) + 2
+assert(sp.x == 42)
+assert(ffi.cast("char *", sp) - ffi.cast("char *", s) ==
+    2 * ffi.sizeof("struct pa_pt"))
@@ -0,0 +1,68 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct ra_small {
+        char c;
+        int a[3];
+        char d;
+    };
+    struct ra_nested {
+        char c;
+        struct ra_small s[2];
+        short m[2][3];
+    };
+
+    typedef struct cffi_test_vec3 {
+        float v[3];
+    } cffi_test_vec3;
+    float cffi_test_vec3_sum(cffi_test_vec3 a);
+    cffi_test_vec3 cffi_test_vec3_scale(cffi_test_vec3 a, float f);
+    typedef struct cffi_test_mixed {
+        double d[1];
+        int n[2];
+    } cffi_test_mixed;
+    double cffi_test_mixed_sum(cffi_test_mixed a);
+]]
+
+-- array members take the space of their elements
+assert(ffi.sizeof("struct ra_small") == 20)
+assert(ffi.alignof("struct ra_small") == 4)
+assert(ffi.offsetof("struct ra_small", "a") == 4)
+assert(ffi.offsetof("struct ra_small", "d") == 16)
+assert(ffi.sizeof("struct ra_nested") == 56)
+assert(ffi.offsetof("struct ra_nested", "s") == 4)
+assert(ffi.offsetof("struct ra_nested", "m") == 44)
+
+local s = ffi.new("struct ra_small")
+s.a[2] = 5
+s.d = 7
+assert(s.a[2] == 5 and s.d == 7)
+
+-- large arrays cost no more to declare than small ones
+local before = ffi.declstats().ffi_bytes
+ffi.cdef [[
+    struct ra_big {
+        char buf[16777216];
+        int x;
+    };
+]]
+assert(ffi.declstats().ffi_bytes - before < 1024)
+assert(ffi.sizeof("struct ra_big") == 16777220)
+assert(ffi.offsetof("struct ra_big", "x") == 16777216)
+
+-- records with arrays are passed by value with all their elements
+local v = ffi.new("struct cffi_test_vec3", { { 1, 2, 3 } })
+assert(ffi.C.cffi_test_vec3_sum(v) == 6)
+local sv = ffi.C.cffi_test_vec3_scale(v, 2)
+assert(sv.v[0] == 2 and sv.v[1] == 4 and sv.v[2] == 6)
+local m = ffi.new("struct cffi_test_mixed", { { 0.5 }, { 2, 3 } })
+assert(ffi.C.cffi_test_mixed_sum(m) == 5.5)
+
+-- and through callbacks
+local cb = ffi.cast(
+    "float (*)(cffi_test_vec3)", function(a)
+        return a.v[0] * a.v[1] * a.v[2]
+    end
+)
+assert(cb(v) == 6)
+cb:free()
@@ -0,0 +1,43 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    typedef struct rc_pair {
+        int a;
+        double b;
+    } rc_pair;
+
+    typedef struct cffi_test_dvec3 {
+        double x;
+        double y;
+        double z;
+    } cffi_test_dvec3;
+    double cffi_test_dvec3_dot(cffi_test_dvec3 a, cffi_test_dvec3 b);
+    cffi_test_dvec3 cffi_test_dvec3_scale(cffi_test_dvec3 a, double f);
+]]
+
+-- records are copied from records of the same type
+local q = ffi.new("rc_pair", 3, 0.5)
+local arr = ffi.new("rc_pair[2]", { q, q })
+q.a = 4
+assert(arr[1].a == 3 and arr[1].b == 0.5)
+q.a = 3
+assert(not pcall(ffi.new, "cffi_test_dvec3[1]", { q }))
+
+-- passed by value to C functions
+local v = ffi.new("cffi_test_dvec3", 1, 2, 3)
+assert(ffi.C.cffi_test_dvec3_dot(v, v) == 14)
+local s = ffi.C.cffi_test_dvec3_scale(v, 2)
+assert(s.x == 2 and s.y == 4 and s.z == 6)
+
+-- and to and from callbacks
+local cb = ffi.cast("rc_pair (*)(rc_pair, int)", function(r, n)
+    assert(r.a == 3)
+    assert(r.b == 0.5)
+    return ffi.new("rc_pair", r.a * n, r.b * n)
+end)
+
+local r = cb(q, 4)
+assert(r.a == 12)
+assert(r.b == 2)
+
+cb:free()
@@ -0,0 +1,50 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    void qsort(void *base, size_t nmemb, size_t size,
+               int (*compar)(void const *, void const *));
+    int snprintf(char *buf, size_t n, char const *fmt, ...);
+]]
+
+-- the same function cdata is entered again while a call is in progress
+local qsort = ffi.C.qsort
+local inner = ffi.new("int[3]")
+local ncalls = 0
+local cmp
+cmp = ffi.cast("int (*)(void const *, void const *)", function(a, b)
+    ncalls = ncalls + 1
+    if ncalls < 4 then
+        inner[0], inner[1], inner[2] = 3, 1, 2
+        qsort(inner, 3, ffi.sizeof("int"), cmp)
+    end
+    local x = ffi.cast("int const *", a)[0]
+    local y = ffi.cast("int const *", b)[0]
+    return (x < y) and -1 or ((x > y) and 1 or 0)
+end)
+local outer = ffi.new("int[5]", { 5, 4, 3, 2, 1 })
+qsort(outer, 5, ffi.sizeof("int"), cmp)
+for i = 0, 4 do
+    assert(outer[i] == i + 1)
+end
+assert(inner[0] == 1 and inner[1] == 2 and inner[2] == 3)
+cmp:free()
+
+-- variadic calls with more arguments than fit on the stack
+local buf = ffi.new("char[128]")
+local fmt = ("%d "):rep(12)
+ffi.C.snprintf(buf, 128, fmt, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12)
+assert(ffi.string(buf) == "1 2 3 4 5 6 7 8 9 10 11 12 ")
+
+-- many fixed arguments
+local sum10 = ffi.cast(
+    "int (*)(int, int, int, int, int, int, int, int, int, int)",
+    function(...)
+        local s = 0
+        for i = 1, select("#", ...) do
+            s = s + select(i, ...)
+        end
+        return s
+    end
+)
+assert(sum10(1, 2, 3, 4, 5, 6, 7, 8, 9, 10) == 55)
+sum10:free()
@@ -0,0 +1,32 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    void *malloc(size_t sz);
+    void free(void *p);
+    struct ra_msg {
+        int id;
+        char name[8];
+        unsigned char raw[4];
+    };
+]]
+
+-- array members of records are references to arrays, which the string
+-- and buffer functions take as the array itself
+local m = ffi.new("struct ra_msg")
+ffi.copy(m.name, "hello")
+assert(ffi.string(m.name) == "hello")
+assert(ffi.string(m.name, 2) == "he")
+ffi.fill(m.raw, 4, 0x41)
+assert(ffi.string(m.raw, 4) == "AAAA")
+assert(m.raw[3] == 0x41)
+ffi.copy(m.raw, m.name, 3)
+assert(ffi.string(m.raw, 4) == "helA")
+assert(m.id == 0)
+
+-- same for adopted arrays
+local src = ffi.gc(ffi.cast("char *", ffi.C.malloc(6)), ffi.C.free)
+ffi.copy(src, "world", 6)
+local a = ffi.adopt(ffi.detach(src), "char[6]")
+assert(ffi.string(a) == "world")
+ffi.copy(a, "abc", 4)
+assert(ffi.string(a) == "abc")
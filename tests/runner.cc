@@ -1,19 +1,268 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include <lua.hh>
 
-int main(int argc, char **argv) {
-    if (argc < 3) {
-        printf("not enough arguments (%d)\n", argc);
-        return 1;
+/* native kernels used by the tests and benchmarks, looked up through cffi.C */
+#if FFI_OS == FFI_OS_WINDOWS
+#  define RUNNER_EXPORT __declspec(dllexport)
+#else
+#  define RUNNER_EXPORT __attribute__((visibility("default")))
+#endif
+
+extern "C" RUNNER_EXPORT void cffi_test_axpy(
+    size_t b, size_t e, double a, double const *x, double *y
+) {
+    for (size_t i = b; i < e; ++i) {
+        y[i] += a * x[i];
     }
-    /* set up a lua state */
+}
+
+/* records passed by value */
+struct cffi_test_dvec3 {
+    double x;
+    double y;
+    double z;
+};
+
+extern "C" RUNNER_EXPORT double cffi_test_dvec3_dot(
+    cffi_test_dvec3 a, cffi_test_dvec3 b
+) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+extern "C" RUNNER_EXPORT cffi_test_dvec3 cffi_test_dvec3_scale(
+    cffi_test_dvec3 a, double f
+) {
+    return cffi_test_dvec3{a.x * f, a.y * f, a.z * f};
+}
+
+/* records with array members, passed by value */
+struct cffi_test_vec3 {
+    float v[3];
+};
+
+extern "C" RUNNER_EXPORT float cffi_test_vec3_sum(cffi_test_vec3 a) {
+    return a.v[0] + a.v[1] + a.v[2];
+}
+
+extern "C" RUNNER_EXPORT cffi_test_vec3 cffi_test_vec3_scale(
+    cffi_test_vec3 a, float f
+) {
+    return cffi_test_vec3{{a.v[0] * f, a.v[1] * f, a.v[2] * f}};
+}
+
+struct cffi_test_mixed {
+    double d[1];
+    int n[2];
+};
+
+extern "C" RUNNER_EXPORT double cffi_test_mixed_sum(cffi_test_mixed a) {
+    return a.d[0] + a.n[0] + a.n[1];
+}
+
+/* out-parameters written before calling back into lua */
+struct cffi_test_wide {
+    double v[10];
+};
+
+extern "C" RUNNER_EXPORT void cffi_test_out_cb(
+    int v, int *out, cffi_test_wide *wout, void (*cb)(int)
+) {
+    *out = v;
+    if (wout) {
+        for (auto &d: wout->v) {
+            d = v;
+        }
+    }
+    cb(v - 1);
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f0() {
+    return 0;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f1(int a) {
+    return a;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f2(int a, int b) {
+    return a + b;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f3(int a, int b, int c) {
+    return a + b + c;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f4(int a, int b, int c, int d) {
+    return a + b + c + d;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f5(
+    int a, int b, int c, int d, int e
+) {
+    return a + b + c + d + e;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f6(
+    int a, int b, int c, int d, int e, int f
+) {
+    return a + b + c + d + e + f;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f7(
+    int a, int b, int c, int d, int e, int f, int g
+) {
+    return a + b + c + d + e + f + g;
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_f8(
+    int a, int b, int c, int d, int e, int f, int g, int h
+) {
+    return a + b + c + d + e + f + g + h;
+}
+
+struct cffi_bench_vec {
+    double x;
+    double y;
+    double z;
+};
+
+extern "C" RUNNER_EXPORT double cffi_bench_dot(
+    cffi_bench_vec a, cffi_bench_vec b
+) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+extern "C" RUNNER_EXPORT cffi_bench_vec cffi_bench_scale(
+    cffi_bench_vec a, double f
+) {
+    return cffi_bench_vec{a.x * f, a.y * f, a.z * f};
+}
+
+extern "C" RUNNER_EXPORT int cffi_bench_callback(int (*cb)(int), int v) {
+    return cb(v);
+}
+
+/* benchmark mode: the script registers cases through the bench global,
+ * each of which is timed over several repetitions after a warmup
+ */
+static constexpr int BENCH_REPS = 7;
+
+struct bench_result {
+    std::string name;
+    long long iters;
+    double min, median, max; /* nanoseconds per operation */
+};
+
+static std::vector<bench_result> bench_results;
+
+static double bench_time(lua_State *L, long long iters) {
+    lua_pushvalue(L, 2);
+    lua_pushinteger(L, lua_Integer(iters));
+    auto t0 = std::chrono::steady_clock::now();
+    lua_call(L, 1, 0);
+    auto t1 = std::chrono::steady_clock::now();
+    auto ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    return ns / double(iters);
+}
+
+/* bench(name, func [, iters]); func is called with the iteration count */
+static int bench_run(lua_State *L) {
+    bench_result res;
+    res.name = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+    res.iters = static_cast<long long>(luaL_optinteger(L, 3, 100000));
+    luaL_argcheck(L, res.iters > 0, 3, "invalid iteration count");
+    /* warm up the caches and let the collector settle */
+    bench_time(L, (res.iters / 10) ? (res.iters / 10) : 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    double times[BENCH_REPS];
+    for (auto &t: times) {
+        t = bench_time(L, res.iters);
+    }
+    std::sort(times, times + BENCH_REPS);
+    res.min = times[0];
+    res.median = times[BENCH_REPS / 2];
+    res.max = times[BENCH_REPS - 1];
+    printf("%-32s %12.2f ns/op\n", res.name.c_str(), res.median);
+    bench_results.push_back(std::move(res));
+    return 0;
+}
+
+static void bench_write_str(FILE *f, char const *str) {
+    fputc('"', f);
+    for (; *str; ++str) {
+        if ((*str == '"') || (*str == '\\')) {
+            fputc('\\', f);
+        }
+        fputc(*str, f);
+    }
+    fputc('"', f);
+}
+
+static bool bench_write(char const *path, char const *script) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    fprintf(f, "{\n  \"lua\": ");
+    bench_write_str(f, LUA_RELEASE);
+    fprintf(f, ",\n  \"script\": ");
+    bench_write_str(f, script);
+    fprintf(f, ",\n  \"reps\": %d,\n  \"results\": [", BENCH_REPS);
+    for (size_t i = 0; i < bench_results.size(); ++i) {
+        auto &r = bench_results[i];
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        bench_write_str(f, r.name.c_str());
+        fprintf(
+            f, ", \"iterations\": %lld, \"ns_per_op\": %.3f, "
+            "\"min\": %.3f, \"max\": %.3f}",
+            r.iters, r.median, r.min, r.max
+        );
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return !fclose(f);
+}
+
+static char const *module_path;
+
+/* copies plain values between states, as light userdata can be */
+static void state_xcopy(lua_State *from, lua_State *to, int n) {
+    int base = lua_gettop(from) - n;
+    for (int i = 1; i <= n; ++i) {
+        int idx = base + i;
+        switch (lua_type(from, idx)) {
+            case LUA_TLIGHTUSERDATA:
+                lua_pushlightuserdata(to, lua_touserdata(from, idx));
+                break;
+            case LUA_TBOOLEAN:
+                lua_pushboolean(to, lua_toboolean(from, idx));
+                break;
+            case LUA_TNUMBER:
+                lua_pushnumber(to, lua_tonumber(from, idx));
+                break;
+            case LUA_TSTRING:
+                lua_pushstring(to, lua_tostring(from, idx));
+                break;
+            default:
+                lua_pushnil(to);
+                break;
+        }
+    }
+}
+
+static lua_State *state_new() {
     auto L = luaL_newstate();
     luaL_openlibs(L);
     /* we need a controlled environment */
     lua_getglobal(L, "package");
-    lua_pushstring(L, argv[1]);
+    lua_pushstring(L, module_path);
     lua_pushstring(L, LUA_DIRSEP);
 #ifdef FFI_WINDOWS_ABI
     lua_pushstring(L, "?.dll");
@@ -22,6 +271,43 @@ int main(int argc, char **argv) {
 #endif
     lua_concat(L, 3);
     lua_setfield(L, -2, "cpath");
+    lua_pop(L, 1);
+    return L;
+}
+
+/* run_state(source, ...); runs the source in a separate state, which is
+ * closed before the results are returned
+ */
+static int state_run(lua_State *L) {
+    size_t len;
+    char const *src = luaL_checklstring(L, 1, &len);
+    int nargs = lua_gettop(L) - 1;
+    auto LS = state_new();
+    if (luaL_loadbuffer(LS, src, len, "=run_state") != 0) {
+        lua_pushstring(L, lua_tostring(LS, -1));
+        lua_close(LS);
+        return lua_error(L);
+    }
+    state_xcopy(L, LS, nargs);
+    if (lua_pcall(LS, nargs, LUA_MULTRET, 0) != 0) {
+        lua_pushstring(L, lua_tostring(LS, -1));
+        lua_close(LS);
+        return lua_error(L);
+    }
+    int nres = lua_gettop(LS);
+    state_xcopy(LS, L, nres);
+    lua_close(LS);
+    return nres;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("not enough arguments (%d)\n", argc);
+        return 1;
+    }
+    /* set up a lua state */
+    module_path = argv[1];
+    auto L = state_new();
 
     /* this will be useful */
     lua_pushcfunction(L, [](lua_State *LL) -> int {
@@ -30,6 +316,17 @@ int main(int argc, char **argv) {
     });
     lua_setglobal(L, "skip_test");
 
+    /* for handles passed between states */
+    lua_pushcfunction(L, state_run);
+    lua_setglobal(L, "run_state");
+
+    /* an output file means we are running benchmarks */
+    char const *bench_out = (argc > 3) ? argv[3] : nullptr;
+    if (bench_out) {
+        lua_pushcfunction(L, bench_run);
+        lua_setglobal(L, "bench");
+    }
+
     /* load test case */
     if (luaL_loadfile(L, argv[2]) != 0) {
         printf("failed loading file '%s': %s\n", argv[2], lua_tostring(L, -1));
@@ -38,5 +335,9 @@ int main(int argc, char **argv) {
     }
     lua_call(L, 0, 0);
     lua_close(L);
+    if (bench_out && !bench_write(bench_out, argv[2])) {
+        printf("failed writing results to '%s'\n", bench_out);
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,87 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct point { int x; int y; };
+    struct opaque;
+    enum color { RED, GREEN, BLUE };
+    int abs(int v);
+]]
+
+local mt = { __index = { sum = function(p) return p.x + p.y end } }
+ffi.metatype("struct point", mt)
+
+local h = ffi.freeze()
+assert(type(h) == "userdata")
+-- nothing new was declared, so the same store is handed out
+assert(ffi.freeze() == h)
+-- attaching a store we already use does nothing
+ffi.attach(h)
+
+-- frozen declarations keep working, including metatypes set before
+local p = ffi.new("struct point", 1, 2)
+assert(p:sum() == 3)
+assert(ffi.C.abs(-5) == 5)
+assert(ffi.C.GREEN == 1)
+
+-- declarations can still be added on top
+ffi.cdef [[
+    struct rect { struct point a; struct point b; };
+]]
+local r = ffi.new("struct rect")
+r.b.x = 4
+assert(r.b.x == 4)
+
+-- frozen declarations are immutable
+assert(not pcall(ffi.cdef, "struct opaque { int x; };"))
+assert(not pcall(ffi.cdef, "struct point { int z; };"))
+assert(not pcall(ffi.metatype, "struct point", {}))
+
+-- freezing again makes a new store based on the previous one
+local h2 = ffi.freeze()
+assert(h2 ~= h)
+assert(ffi.new("struct rect").a.x == 0)
+-- the older store is a part of the new one
+ffi.attach(h2)
+ffi.attach(h)
+assert(p:sum() == 3)
+
+assert(not pcall(ffi.attach, 5))
+
+-- handles are not tied to the state that froze them
+local hs = run_state([[
+    local ffi = require("cffi")
+    ffi.cdef("struct other { int a; int b; };")
+    return ffi.freeze()
+]])
+local src = [[
+    local ffi = require("cffi")
+    ffi.attach(...)
+    local o = ffi.new("struct other", 3, 4)
+    return o.a + o.b
+]]
+assert(run_state(src, hs) == 7)
+-- other states can attach ours
+assert(run_state([[
+    local ffi = require("cffi")
+    ffi.attach(...)
+    return ffi.new("struct point", 5, 6).y
+]], h2) == 6)
+
+-- released handles cannot be attached
+ffi.release(hs)
+assert(not pcall(run_state, src, hs))
+assert(not pcall(ffi.release, hs))
+
+-- failed attaches keep the store referenced only by its handle
+local hc = run_state([[
+    local ffi = require("cffi")
+    ffi.cdef("struct point { int z; };")
+    return ffi.freeze()
+]])
+local ok, err = pcall(run_state, [[
+    local ffi = require("cffi")
+    ffi.cdef("struct point { int w; };")
+    ffi.attach(...)
+]], hc)
+assert(not ok and err:find("redefined"))
+ffi.release(hc)
@@ -0,0 +1,85 @@
+local ffi = require("cffi")
+
+if ffi.os == "Windows" then
+    return
+end
+
+ffi.cdef [[
+    struct shm_stats {
+        int requests;
+        int errors;
+        double load;
+    };
+
+    int getpid(void);
+    int fork(void);
+    int waitpid(int pid, int *status, int options);
+    void _exit(int status);
+]]
+
+collectgarbage()
+local base = ffi.memstats().mapped
+
+-- named segments are shared between mappings
+local name = "/cffi_test_" .. ffi.C.getpid()
+local a = ffi.shm(name, "struct shm_stats", { create = true })
+assert(ffi.istype("struct shm_stats &", a))
+assert(a.requests == 0 and a.load == 0)
+a.requests = 42
+a.load = 0.5
+
+local b = ffi.shm(name, "struct shm_stats")
+assert(b.requests == 42 and b.load == 0.5)
+b.errors = 3
+assert(a.errors == 3)
+assert(ffi.memstats().mapped >= base + 2 * ffi.sizeof("struct shm_stats"))
+
+-- the name goes away, the mappings stay
+ffi.shm_unlink(name)
+assert(not pcall(ffi.shm, name, "struct shm_stats"))
+assert(a.errors == 3)
+
+-- an existing segment must be large enough
+local big = ffi.shm(name, "int[16]", { create = true, size = 4096 })
+assert(big[15] == 0)
+assert(not pcall(ffi.shm, name, "int[2048]"))
+local vla = ffi.shm(name, "int[?]", 1024)
+big[1000] = 7
+assert(vla[1000] == 7)
+ffi.shm_unlink(name)
+assert(not pcall(ffi.shm_unlink, name))
+
+-- bad arguments
+assert(not pcall(ffi.shm, nil, "void"))
+assert(not pcall(ffi.shm, nil, "int[]"))
+assert(not pcall(ffi.shm, nil, "int", { size = 2 }))
+
+-- anonymous segments are shared with forked children
+local cnt = ffi.shm(nil, "long[4]")
+assert(cnt[0] == 0)
+local pid = ffi.C.fork()
+assert(pid >= 0)
+if pid == 0 then
+    ffi.atomic.add(cnt, 5)
+    cnt[3] = 99
+    ffi.C._exit(0)
+end
+local st = ffi.new("int[1]")
+assert(ffi.C.waitpid(pid, st, 0) == pid)
+assert(st[0] == 0)
+assert(ffi.atomic.load(cnt) == 5)
+assert(cnt[3] == 99)
+
+-- mappings belong to the cdata, not to its finalizer
+local fin = false
+local fm = ffi.gc(ffi.shm(nil, "int[64]"), function() fin = true end)
+fm[63] = 1
+ffi.gc(fm, nil)
+assert(not pcall(ffi.detach, fm))
+
+-- mappings are released with their cdata
+a, b, big, vla, cnt, fm = nil, nil, nil, nil, nil, nil
+collectgarbage()
+collectgarbage()
+assert(ffi.memstats().mapped == base)
+assert(not fin)
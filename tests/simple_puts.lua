@@ -6,3 +6,7 @@ ffi.cdef [[
 
 local ret = ffi.C.puts("hello world")
 assert(ret >= 0)
+
+-- undeclared and immutable symbols cannot be assigned
+assert(not pcall(function() ffi.C.cffi_no_such_symbol = 5 end))
+assert(not pcall(function() ffi.C.puts = 5 end))
@@ -0,0 +1,48 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct particle {
+        double x;
+        double y;
+        int id;
+        char tag;
+    };
+]]
+
+local n = 100
+local s = ffi.soa("struct particle", n)
+assert(#s == n)
+
+for i = 0, n - 1 do
+    s[i].x = i * 0.5
+    s[i].id = i
+end
+s:set(3, "tag", 65)
+
+assert(s[10].x == 5)
+assert(s[10].y == 0)
+assert(s[10].id == 10)
+assert(s:get(3, "tag") == 65)
+
+-- columns are contiguous and typed
+local xs = s:column("x")
+assert(ffi.istype("double *", xs))
+assert(xs[4] == 2)
+xs[4] = 42
+assert(s[4].x == 42)
+
+local ids = s:column("id")
+assert(ids[n - 1] == n - 1)
+
+-- rows and columns keep the container alive
+local row = s[7]
+s = nil
+collectgarbage()
+assert(row.id == 7)
+assert(xs[7] == 3.5)
+
+assert(not pcall(function() return row.z end))
+assert(not pcall(function() return ffi.soa("struct particle", 2)[2] end))
+
+-- sizes that do not fit are an error rather than a short allocation
+assert(not pcall(ffi.soa, "struct particle", 2 ^ 60))
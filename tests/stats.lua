@@ -0,0 +1,81 @@
+local ffi = require("cffi")
+
+local st = ffi.stats()
+if os.getenv("CFFI_TEST_STATS") == "1" then
+    assert(st, "built with the stats option but there are no counters")
+end
+if not st then
+    -- built without the counters, which is a stub that never fails
+    assert(select("#", ffi.stats()) == 1)
+    assert(ffi.stats(true) == nil)
+    assert(ffi.stats(false) == nil)
+    ffi.new("int[4]")
+    assert(ffi.stats() == nil)
+    return
+end
+
+ffi.cdef [[
+    struct stats_rec {
+        int a;
+        double b;
+    };
+    int abs(int v);
+    int snprintf(char *buf, size_t n, char const *fmt, ...);
+    unsigned long long strtoull(char const *s, char **end, int base);
+]]
+
+local function delta(f)
+    ffi.stats(true)
+    f()
+    return ffi.stats()
+end
+
+st = delta(function()
+    local x = ffi.new("int", 5)
+    local p = ffi.new("int *")
+    local r = ffi.new("struct stats_rec", 1, 2)
+    local a = ffi.new("int[4]")
+    local f = ffi.C.abs
+    local cb = ffi.cast("int (*)(int)", function(v) return v end)
+    cb:free()
+end)
+assert(st.cdata_scalar == 1)
+assert(st.cdata_pointer == 1)
+assert(st.cdata_record == 1)
+assert(st.cdata_array == 1)
+assert(st.cdata_func == 1)
+assert(st.cdata_callback == 1)
+assert(st.bytes > 0)
+assert(st.prep_cif >= 2)
+assert(st.ref_callback == 1)
+-- the flat initializer of the record
+assert(st.slow_from_lua == 1)
+
+st = delta(function()
+    local buf = ffi.new("char[16]")
+    ffi.C.snprintf(buf, 16, "%d", 5)
+    ffi.C.snprintf(buf, 16, "%d", 6)
+end)
+assert(st.prep_cif_var == 2)
+
+st = delta(function()
+    ffi.gc(ffi.new("int"), function() end)
+    -- 64-bit unsigned results do not fit into a Lua number
+    local big = ffi.C.strtoull("5", nil, 10)
+    local n = ffi.C.abs(ffi.new("long", -3))
+end)
+assert(st.ref_finalizer == 1)
+assert(st.slow_to_lua >= 1)
+assert(st.slow_from_lua >= 1)
+
+-- types with owned parts are copied deeply into each cdata
+local pt = ffi.typeof("int *[2]")
+st = delta(function()
+    pt()
+end)
+assert(st.type_copies > 0)
+
+-- resetting
+ffi.stats(true)
+st = ffi.stats()
+assert(st.cdata_scalar == 0 and st.bytes == 0)
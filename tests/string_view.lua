@@ -0,0 +1,34 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    void *memchr(void const *s, int c, size_t n);
+    int memcmp(unsigned char const *a, unsigned char const *b, size_t n);
+    size_t strlen(signed char const *s);
+]]
+
+local str = "hello world"
+
+-- strings pass to any pointer to const bytes without a copy
+local p = ffi.C.memchr(str, string.byte("w"), #str)
+assert(p ~= ffi.nullptr)
+assert(ffi.string(p) == "world")
+assert(ffi.C.memcmp(str, "hello", 5) == 0)
+assert(ffi.tonumber(ffi.C.strlen(str)) == #str)
+
+-- and in casts
+local up = ffi.cast("uint8_t const *", str)
+assert(up[0] == string.byte("h"))
+
+-- but not to mutable pointers
+assert(not pcall(ffi.new, "unsigned char *", str))
+
+local v = ffi.view(str)
+assert(ffi.istype("char const *", v))
+assert(ffi.string(v, 5) == "hello")
+
+v = ffi.view(("x"):rep(16) .. "abcd", "uint8_t")
+assert(ffi.istype("uint8_t const *", v))
+collectgarbage()
+assert(v[16] == string.byte("a"))
+assert(v[19] == string.byte("d"))
+assert(ffi.C.memcmp(v + 16, "abcd", 4) == 0)
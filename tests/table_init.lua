@@ -108,3 +108,35 @@ x = ffi.new("union uinit", { s = str })
 assert(ffi.string(x.s) == "hello world")
 assert(x.s == ffi.cast("void *", x.a))
 assert(x.s ~= x.a)
+
+-- each element table of an array of records is its own initializer
+ffi.cdef [[ struct ni_pt { int x; int y; }; ]]
+x = ffi.new("struct ni_pt[2]", { { x = 1, y = 2 }, { 3, 4 } })
+assert(x[0].x == 1 and x[0].y == 2)
+assert(x[1].x == 3 and x[1].y == 4)
+
+x = ffi.new("double[?]", 4, { 0.5, 1.5, true, 3.5 })
+assert(x[0] == 0.5)
+assert(x[1] == 1.5)
+assert(x[2] == 1)
+assert(x[3] == 3.5)
+
+x = ffi.new("int[2][3]", { { 1, 2, 3 }, { 4, 5, 6 } })
+assert(x[0][0] == 1)
+assert(x[0][2] == 3)
+assert(x[1][0] == 4)
+assert(x[1][2] == 6)
+
+local src = ffi.new("int[3]", { 7, 8, 9 })
+x = ffi.new("int[?]", 4, src)
+assert(x[0] == 7)
+assert(x[1] == 8)
+assert(x[2] == 9)
+assert(x[3] == 0)
+
+x = ffi.new("int[2][3]", { src, src })
+assert(x[0][1] == 8)
+assert(x[1][2] == 9)
+
+-- pointers have no size to copy from
+assert(not pcall(ffi.new, "int[3]", ffi.cast("int *", src)))
@@ -0,0 +1,65 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct trace_pt {
+        int x;
+        int y;
+    };
+    unsigned long long strtoull(char const *s, char **end, int base);
+    void *memset(void *p, int c, size_t n);
+]]
+
+ffi.metatype("struct trace_pt", {
+    __index = {
+        len2 = function(self) return self.x * self.x + self.y * self.y end
+    }
+})
+
+local function site(off)
+    local info = debug.getinfo(2, "Sl")
+    return info.short_src .. ":" .. (info.currentline + off)
+end
+
+local cs = ffi.view("abc")
+
+-- nothing is recorded while stopped
+ffi.string(cs)
+assert(#ffi.trace.report() == 0)
+
+ffi.trace.start()
+local s_box = site(1)
+for i = 1, 3 do ffi.C.strtoull("5", nil, 10) end
+local buf = ffi.new("int[4]")
+local s_ptr = site(1)
+ffi.C.memset(buf, 0, 16)
+local s_str = site(1)
+local str = ffi.string(cs)
+local s_init = site(1)
+local pt = ffi.new("struct trace_pt", 3, 4)
+local s_mt = site(1)
+assert(pt:len2() == 25)
+local s_unbox = site(1)
+pt.x = ffi.new("long", 5)
+ffi.trace.stop()
+
+ffi.string(cs)
+
+local rep = ffi.trace.report()
+local bysite = {}
+for i, e in ipairs(rep) do
+    bysite[e.site] = e
+    if i > 1 then
+        assert(rep[i - 1].count >= e.count)
+    end
+end
+assert(rep[1].site == s_box and rep[1].box == 3 and rep[1].count == 3)
+assert(bysite[s_ptr].ptr_convert == 1)
+assert(bysite[s_str].str_copy == 1)
+assert(bysite[s_init].table_init == 1)
+assert(bysite[s_mt].metatype_index == 1)
+assert(bysite[s_unbox].unbox == 1)
+
+-- restarting clears the data
+ffi.trace.start()
+ffi.trace.stop()
+assert(#ffi.trace.report() == 0)
@@ -0,0 +1,101 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    void *malloc(size_t sz);
+    void free(void *p);
+    struct msg { int id; double a; double b; };
+    struct wrap { struct msg m; int v[2]; };
+]]
+
+-- memory from the C heap is handed off along with its C finalizer
+-- and adopted by reference
+local function cnew(ct, n)
+    return ffi.gc(ffi.cast(ct, ffi.C.malloc(n)), ffi.C.free)
+end
+
+local m = cnew("struct msg *", ffi.sizeof("struct msg"))
+m.id, m.a, m.b = 5, 1, 4
+local h = ffi.detach(m)
+assert(type(h) == "userdata")
+local am = ffi.adopt(h, "struct msg")
+assert(am.id == 5)
+assert(am.b == 4)
+am.a = 10
+assert(am.a == 10)
+
+-- adopted payloads can be handed off again
+local h2 = ffi.detach(am)
+local am2 = ffi.adopt(h2, ffi.typeof("struct msg"))
+assert(am2.a == 10)
+assert(am2.id == 5)
+
+-- pointers move in place along with their C finalizer
+local p = ffi.gc(ffi.cast("int *", ffi.C.malloc(16)), ffi.C.free)
+p[1] = 42
+local addr = ffi.cast("void *", p)
+local hp = ffi.detach(p)
+assert(p == ffi.nullptr)
+local ap = ffi.adopt(hp, "int *")
+assert(ffi.cast("void *", ap) == addr)
+assert(ap[1] == 42)
+
+-- arrays
+local arr = cnew("int *", 3 * ffi.sizeof("int"))
+arr[0], arr[1], arr[2] = 7, 8, 9
+local aa = ffi.adopt(ffi.detach(arr), "int[3]")
+assert(aa[2] == 9)
+-- a failed adoption leaves the handle valid
+local va = cnew("int *", 3 * ffi.sizeof("int"))
+va[2] = 3
+local ha = ffi.detach(va)
+assert(not pcall(ffi.adopt, ha, "void"))
+assert(ffi.adopt(ha, "int[3]")[2] == 3)
+local ra = ffi.adopt(ffi.detach(cnew("int *", 8)), "int[2]")
+ra[0], ra[1] = 3, 4
+local ra2 = ffi.adopt(ffi.detach(ra), "int[2]")
+assert(ra2[0] == 3 and ra2[1] == 4)
+
+-- handles are consumed by adoption
+assert(not pcall(ffi.adopt, h, "struct msg"))
+assert(not pcall(ffi.adopt, hp, "int *"))
+-- only handles made by detach are accepted
+local hf = ffi.freeze()
+assert(not pcall(ffi.adopt, hf, "int"))
+ffi.release(hf)
+
+-- handles that are not adopted can be released, which finalizes them
+local hr = ffi.detach(ffi.gc(ffi.cast("int *", ffi.C.malloc(4)), ffi.C.free))
+ffi.release(hr)
+assert(not pcall(ffi.adopt, hr, "int *"))
+assert(not pcall(ffi.release, hr))
+
+-- and adopted by other states
+local sa = cnew("int *", 8)
+sa[0], sa[1] = 5, 6
+assert(run_state([[
+    local ffi = require("cffi")
+    return ffi.adopt(..., "int[2]")[1]
+]], ffi.detach(sa)) == 6)
+
+-- values stored in the cdata itself are not copied out
+assert(not pcall(ffi.detach, ffi.new("struct msg")))
+assert(not pcall(ffi.detach, ffi.new("int[2]")))
+assert(not pcall(ffi.detach, ffi.new("int", 5)))
+
+-- neither can references and pointers that do not own their memory
+local w = ffi.new("struct wrap")
+assert(not pcall(ffi.detach, w.m))
+assert(not pcall(ffi.detach, w.v))
+assert(not pcall(ffi.detach, ffi.cast("int *", w.v)))
+local mp = ffi.C.malloc(4)
+assert(not pcall(ffi.detach, mp))
+ffi.C.free(mp)
+
+-- finalizers written in Lua cannot be transferred
+local lp = ffi.gc(ffi.new("int[1]"), function() end)
+assert(not pcall(ffi.detach, lp))
+assert(not pcall(ffi.detach, ffi.C.free))
+
+am, am2, ap, aa, ra2 = nil, nil, nil, nil, nil
+collectgarbage()
+collectgarbage()
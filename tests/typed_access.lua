@@ -0,0 +1,56 @@
+local ffi = require("cffi")
+
+-- arrays and pointers of scalars behave the same as other cdata
+local a = ffi.new("double[4]", 1.5, 2.5)
+assert(ffi.type(a) == "cdata")
+assert(ffi.istype("double[4]", a))
+assert(a[0] == 1.5 and a[1] == 2.5 and a[3] == 0)
+a[2] = 7
+assert(a[2] == 7)
+
+local p = ffi.cast("double *", a) + 1
+assert(ffi.istype("double *", p))
+assert(p[0] == 2.5)
+assert(p[-1] == 1.5)
+p[1] = 3
+assert(a[2] == 3)
+assert(getmetatable(a) == "ffi")
+assert(tostring(p):match("^cdata<double %*>"))
+assert(p - ffi.cast("double *", a) == 1)
+
+-- integer elements are truncated to the element type
+local b = ffi.new("uint8_t[2]")
+b[0] = 257
+assert(b[0] == 1)
+local s = ffi.new("short[1]")
+s[0] = -2
+assert(s[0] == -2)
+local f = ffi.new("float[1]")
+f[0] = 0.5
+assert(f[0] == 0.5)
+
+-- keys and values that are not numbers take the generic path
+local c = ffi.new("char[4]")
+c[ffi.new("int", 1)] = 65
+assert(c[1] == 65)
+c[2] = ffi.new("char", 66)
+assert(c[2] == 66)
+c[3] = true
+assert(c[3] == 1)
+assert(ffi.string(ffi.cast("char *", c) + 1, 2) == "AB")
+assert(not pcall(function() return a.x end))
+assert(not pcall(function() a.x = 1 end))
+
+-- 64-bit elements that do not fit a Lua number are still boxed
+local u = ffi.new("uint64_t[1]")
+u[0] = ffi.cast("uint64_t", -1)
+assert(u[0] == ffi.cast("uint64_t", -1))
+
+-- the element type decides, not the cdata
+local pp = ffi.new("int *[1]")
+pp[0] = ffi.new("int[1]", 5)
+assert(ffi.istype("int *", pp[0]))
+
+-- ctypes keep the common behavior
+local dp = ffi.typeof("double *")
+assert(not pcall(function() return dp[0] end))
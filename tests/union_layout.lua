@@ -0,0 +1,38 @@
+local ffi = require("cffi")
+
+ffi.cdef [[
+    struct ul_three {
+        char a;
+        char b;
+        char c;
+    };
+    union ul_u {
+        struct ul_three t;
+        short h;
+    };
+    struct ul_outer {
+        union ul_u u;
+        char tail;
+    };
+    union ul_big {
+        struct ul_three t;
+        int i;
+        char c;
+    };
+]]
+
+-- unions are padded to a multiple of their alignment
+assert(ffi.sizeof("union ul_u") == 4)
+assert(ffi.alignof("union ul_u") == 2)
+assert(ffi.sizeof("union ul_big") == 4)
+assert(ffi.sizeof("union ul_u[3]") == 12)
+
+-- which moves whatever comes after them
+assert(ffi.offsetof("struct ul_outer", "tail") == 4)
+assert(ffi.sizeof("struct ul_outer") == 6)
+
+local arr = ffi.new("union ul_u[2]")
+arr[1].h = 0x1234
+arr[0].t.c = 7
+assert(arr[1].h == 0x1234)
+assert(arr[0].t.c == 7)
@@ -18,3 +18,15 @@ assert(ffi.string(buf) == "123456")
 local ret = ffi.C.snprintf(buf, bufs, "%s %g", "hello", 3.14)
 assert(ret == 10)
 assert(ffi.string(buf) == "hello 3.14")
+
+-- records are passed to the vararg part by address
+ffi.cdef [[
+    struct va_str { char s[8]; };
+]]
+local rec = ffi.new("struct va_str")
+for i = 1, 3 do
+    rec.s[i - 1] = ("rec"):byte(i)
+end
+local ret = ffi.C.snprintf(buf, bufs, "%s %d", rec, 5)
+assert(ret == 5)
+assert(ffi.string(buf) == "rec 5")